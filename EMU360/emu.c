@@ -11,6 +11,10 @@ void EVENT_USB_Device_ControlRequest(void) {
 
     static uint8_t buffer[MAX_CONTROL_TRANSFER_SIZE];
 
+    if (descriptor_request()) {
+        return;
+    }
+
     if (USB_ControlRequest.bmRequestType & REQTYPE_VENDOR) {
         if (!spoof_initialized) {
             if (!(USB_ControlRequest.bmRequestType & REQDIR_DEVICETOHOST)) {
@@ -18,22 +22,18 @@ void EVENT_USB_Device_ControlRequest(void) {
                 Endpoint_Read_Control_Stream_LE(buffer, USB_ControlRequest.wLength);
                 Endpoint_ClearIN();
             }
-            spoofReply = 0;
-            send_spoof_header();
             if (USB_ControlRequest.bmRequestType & REQDIR_DEVICETOHOST) {
-                while (!spoofReply) {}
-                Endpoint_ClearSETUP();
-                Endpoint_Write_Control_Stream_LE(buf, spoofReplyLen);
-                Endpoint_ClearOUT();
                 if (USB_ControlRequest.wValue == 0x5c10) {
                     if (response) {
-                        spoof_initialized = BYTE_STATUS_SPOOFED;
+                        controlSpoofs = 1;
                     }
                     response = 1;
                 } else if (USB_ControlRequest.wValue == 0x5b17) {
                 }
+                spoof_deferred();
             } else {
-                Serial_SendData(buffer, USB_ControlRequest.wLength);
+                send_spoof_header();
+                Serial_QueueData(buffer, USB_ControlRequest.wLength);
             }
         } else {
             if (USB_ControlRequest.bmRequestType & REQDIR_DEVICETOHOST) {
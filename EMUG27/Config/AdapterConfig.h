@@ -8,5 +8,6 @@
 #define ADAPTER_OUT_NUM      (ENDPOINT_DIR_OUT | 2)
 #define ADAPTER_OUT_SIZE     16
 #define ADAPTER_OUT_INTERVAL 2
+#define ADAPTER_OUT_BANKS    2
 
 #endif
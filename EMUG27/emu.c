@@ -9,6 +9,11 @@ void EVENT_USB_Device_ControlRequest(void)
 {
   static uint8_t buffer[MAX_CONTROL_TRANSFER_SIZE];
 
+	if (descriptor_request())
+	{
+		return;
+	}
+
 	switch (USB_ControlRequest.bRequest)
 	{
     case REQ_SetIdle:
@@ -25,10 +30,10 @@ void EVENT_USB_Device_ControlRequest(void)
         uint8_t reportType = USB_ControlRequest.wValue >> 8;
         uint8_t reportId = USB_ControlRequest.wValue & 0xff;
 
-        Serial_SendByte(BYTE_DEBUG);
-        Serial_SendByte(2);
-        Serial_SendByte(reportType);
-        Serial_SendByte(reportId);
+        Serial_QueueByte(BYTE_DEBUG);
+        Serial_QueueByte(2);
+        Serial_QueueByte(reportType);
+        Serial_QueueByte(reportId);
       }
       break;
     case REQ_SetReport:
@@ -46,9 +51,9 @@ void EVENT_USB_Device_ControlRequest(void)
           switch(reportId)
           {
             default:
-              Serial_SendByte(BYTE_DEBUG);
-              Serial_SendByte(sizeof(USB_ControlRequest));
-              Serial_SendData(&USB_ControlRequest, sizeof(USB_ControlRequest));
+              Serial_QueueByte(BYTE_DEBUG);
+              Serial_QueueByte(sizeof(USB_ControlRequest));
+              Serial_QueueData(&USB_ControlRequest, sizeof(USB_ControlRequest));
               break;
           }
         }
@@ -8,5 +8,6 @@
 #define ADAPTER_OUT_NUM      (ENDPOINT_DIR_OUT | 3)
 #define ADAPTER_OUT_SIZE     64
 #define ADAPTER_OUT_INTERVAL 5
+#define ADAPTER_OUT_BANKS    2
 
 #endif
@@ -9,6 +9,10 @@ void EVENT_USB_Device_ControlRequest(void) {
 
     static uint8_t buffer[MAX_CONTROL_TRANSFER_SIZE];
 
+    if (descriptor_request()) {
+        return;
+    }
+
     switch (USB_ControlRequest.bRequest) {
     case REQ_SetIdle:
       if (USB_ControlRequest.bmRequestType == (REQDIR_HOSTTODEVICE | REQTYPE_CLASS | REQREC_INTERFACE))
@@ -26,9 +30,9 @@ void EVENT_USB_Device_ControlRequest(void) {
             if (reportType == REPORT_TYPE_FEATURE) {
                 switch (reportId) {
                 default:
-                    Serial_SendByte(BYTE_DEBUG);
-                    Serial_SendByte(BYTE_LEN_1_BYTE);
-                    Serial_SendByte(reportId);
+                    Serial_QueueByte(BYTE_DEBUG);
+                    Serial_QueueByte(BYTE_LEN_1_BYTE);
+                    Serial_QueueByte(reportId);
                     break;
                 }
             }
@@ -46,10 +50,10 @@ void EVENT_USB_Device_ControlRequest(void) {
             if (reportType == REPORT_TYPE_FEATURE) {
                 switch (reportId) {
                 default:
-                    Serial_SendByte(BYTE_DEBUG);
-                    Serial_SendByte(sizeof(USB_ControlRequest) + (USB_ControlRequest.wLength & 0xFF));
-                    Serial_SendData(&USB_ControlRequest, sizeof(USB_ControlRequest));
-                    Serial_SendData(buffer, USB_ControlRequest.wLength);
+                    Serial_QueueByte(BYTE_DEBUG);
+                    Serial_QueueByte(sizeof(USB_ControlRequest) + (USB_ControlRequest.wLength & 0xFF));
+                    Serial_QueueData(&USB_ControlRequest, sizeof(USB_ControlRequest));
+                    Serial_QueueData(buffer, USB_ControlRequest.wLength);
                     break;
                 }
             }
@@ -14,17 +14,25 @@ static const uint8_t PROGMEM magic_init_bytes[] = {
         0x21, 0x26, 0x01, 0x07, 0x00, 0x00, 0x00, 0x00  // TODO MLA
 };
 
+static const struct control_entry PROGMEM controlEntries[] = {
+        FEATURE_REPLY(0x00, magic_init_bytes),
+};
+
 void EVENT_USB_Device_ControlRequest(void) {
+
+    if (descriptor_request()) {
+        return;
+    }
+
+    if (CONTROL_DISPATCH(controlEntries)) {
+        return;
+    }
+
     switch (USB_ControlRequest.bRequest) {
     case HID_REQ_GetReport:
         if (USB_ControlRequest.bmRequestType == (REQDIR_DEVICETOHOST | REQTYPE_CLASS | REQREC_INTERFACE)) {
             Endpoint_ClearSETUP();
-            if (USB_ControlRequest.wValue == 0x0300) {
-                Endpoint_Write_Control_PStream_LE(magic_init_bytes, sizeof(magic_init_bytes));
-            } else {
-                Endpoint_Write_Control_Stream_LE(report,  USB_ControlRequest.wLength);
-            }
-
+            Endpoint_Write_Control_Stream_LE(reports[reportReady],  USB_ControlRequest.wLength);
             Endpoint_ClearOUT();
         }
         break;
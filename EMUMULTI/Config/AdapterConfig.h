@@ -0,0 +1,18 @@
+#ifndef _ADAPTER_CONFIG_H_
+#define _ADAPTER_CONFIG_H_
+
+#include "../Persona.h"
+
+#define ADAPTER_PERSONAS
+
+#define ADAPTER_TYPE         (persona.type)
+#define ADAPTER_IN_NUM       (persona.inNum)
+#define ADAPTER_IN_SIZE      (persona.inSize)
+#define ADAPTER_IN_MAX_SIZE  64
+#define ADAPTER_IN_INTERVAL  (persona.inInterval)
+#define ADAPTER_OUT_NUM      (persona.outNum)
+#define ADAPTER_OUT_SIZE     (persona.outSize)
+#define ADAPTER_OUT_MAX_SIZE 64
+#define ADAPTER_OUT_INTERVAL (persona.outInterval)
+
+#endif
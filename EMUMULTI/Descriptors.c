@@ -0,0 +1,60 @@
+/*
+ Copyright (c) 2019 Mathieu Laurendeau <mat.lau@laposte.net>
+ License: GPLv3
+ */
+
+#include <avr/pgmspace.h>
+#include <avr/eeprom.h>
+#include "LUFA/Drivers/USB/USB.h"
+#include "Persona.h"
+
+extern const struct persona PROGMEM ps3Persona;
+extern const struct persona PROGMEM ps4Persona;
+extern const struct persona PROGMEM x360Persona;
+extern const struct persona PROGMEM xonePersona;
+
+/*
+ * The first one is the default.
+ */
+static const struct persona * const personas[] = {
+        &ps3Persona,
+        &ps4Persona,
+        &x360Persona,
+        &xonePersona,
+};
+
+struct persona persona;
+
+static uint8_t EEMEM savedType;
+
+/*
+ * Select the persona of an adapter type and save it for the next boots, returns 0 if the type is not supported.
+ */
+uint8_t Persona_Select(uint8_t type) {
+
+    uint8_t i;
+
+    for (i = 0; i < sizeof(personas) / sizeof(*personas); ++i) {
+        if (pgm_read_byte(&personas[i]->type) == type) {
+            memcpy_P(&persona, personas[i], sizeof(persona));
+            eeprom_update_byte(&savedType, type);
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/*
+ * Select the saved persona, or the default one.
+ */
+void Persona_Load(void) {
+
+    if (!Persona_Select(eeprom_read_byte(&savedType))) {
+        memcpy_P(&persona, personas[0], sizeof(persona));
+    }
+}
+
+uint16_t CALLBACK_USB_GetDescriptor(const uint16_t wValue, const uint8_t wIndex, const void **const DescriptorAddress) {
+
+    return persona.getDescriptor(wValue, wIndex, DescriptorAddress);
+}
@@ -0,0 +1,34 @@
+/*
+ Copyright (c) 2019 Mathieu Laurendeau <mat.lau@laposte.net>
+ License: GPLv3
+ */
+
+#include <avr/pgmspace.h>
+#include "LUFA/Drivers/USB/USB.h"
+#include "../adapter_protocol.h"
+#include "Persona.h"
+
+#define FIXED_CONTROL_ENDPOINT_SIZE 8
+
+#define DeviceDescriptor           x360DeviceDescriptor
+#define ConfigurationDescriptor    x360ConfigurationDescriptor
+#define XboxString                 x360XboxString
+#define ModString                  x360ModString
+#define LanguageString             x360LanguageString
+#define ManufacturerString         x360ManufacturerString
+#define ProductString              x360ProductString
+#define SerialString               x360SerialString
+#define CALLBACK_USB_GetDescriptor x360_get_descriptor
+
+#include "../EMU360/Descriptors.c"
+
+const struct persona PROGMEM x360Persona = {
+        .type = ADAPTER_TYPE,
+        .inNum = ADAPTER_IN_NUM,
+        .inSize = ADAPTER_IN_SIZE,
+        .inInterval = ADAPTER_IN_INTERVAL,
+        .outNum = ADAPTER_OUT_NUM,
+        .outSize = ADAPTER_OUT_SIZE,
+        .outInterval = ADAPTER_OUT_INTERVAL,
+        .getDescriptor = x360_get_descriptor,
+};
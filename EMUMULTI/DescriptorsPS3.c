@@ -0,0 +1,32 @@
+/*
+ Copyright (c) 2019 Mathieu Laurendeau <mat.lau@laposte.net>
+ License: GPLv3
+ */
+
+#include <avr/pgmspace.h>
+#include "LUFA/Drivers/USB/USB.h"
+#include "../adapter_protocol.h"
+#include "Persona.h"
+
+#define FIXED_CONTROL_ENDPOINT_SIZE 64
+
+#define Report                     ps3Report
+#define DeviceDescriptor           ps3DeviceDescriptor
+#define ConfigurationDescriptor    ps3ConfigurationDescriptor
+#define LanguageString             ps3LanguageString
+#define ManufacturerString         ps3ManufacturerString
+#define ProductString              ps3ProductString
+#define CALLBACK_USB_GetDescriptor ps3_get_descriptor
+
+#include "../EMUPS3/Descriptors.c"
+
+const struct persona PROGMEM ps3Persona = {
+        .type = ADAPTER_TYPE,
+        .inNum = ADAPTER_IN_NUM,
+        .inSize = ADAPTER_IN_SIZE,
+        .inInterval = ADAPTER_IN_INTERVAL,
+        .outNum = ADAPTER_OUT_NUM,
+        .outSize = ADAPTER_OUT_SIZE,
+        .outInterval = ADAPTER_OUT_INTERVAL,
+        .getDescriptor = ps3_get_descriptor,
+};
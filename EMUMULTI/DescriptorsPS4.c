@@ -0,0 +1,32 @@
+/*
+ Copyright (c) 2019 Mathieu Laurendeau <mat.lau@laposte.net>
+ License: GPLv3
+ */
+
+#include <avr/pgmspace.h>
+#include "LUFA/Drivers/USB/USB.h"
+#include "../adapter_protocol.h"
+#include "Persona.h"
+
+#define FIXED_CONTROL_ENDPOINT_SIZE 64
+
+#define Report                     ps4Report
+#define DeviceDescriptor           ps4DeviceDescriptor
+#define ConfigurationDescriptor    ps4ConfigurationDescriptor
+#define LanguageString             ps4LanguageString
+#define ManufacturerString         ps4ManufacturerString
+#define ProductString              ps4ProductString
+#define CALLBACK_USB_GetDescriptor ps4_get_descriptor
+
+#include "../EMUPS4/Descriptors.c"
+
+const struct persona PROGMEM ps4Persona = {
+        .type = ADAPTER_TYPE,
+        .inNum = ADAPTER_IN_NUM,
+        .inSize = ADAPTER_IN_SIZE,
+        .inInterval = ADAPTER_IN_INTERVAL,
+        .outNum = ADAPTER_OUT_NUM,
+        .outSize = ADAPTER_OUT_SIZE,
+        .outInterval = ADAPTER_OUT_INTERVAL,
+        .getDescriptor = ps4_get_descriptor,
+};
@@ -0,0 +1,34 @@
+/*
+ Copyright (c) 2019 Mathieu Laurendeau <mat.lau@laposte.net>
+ License: GPLv3
+ */
+
+#include <avr/pgmspace.h>
+#include "LUFA/Drivers/USB/USB.h"
+#include "../adapter_protocol.h"
+#include "Persona.h"
+
+#define FIXED_CONTROL_ENDPOINT_SIZE 64
+
+#define DeviceDescriptor           xoneDeviceDescriptor
+#define ConfigurationDescriptor    xoneConfigurationDescriptor
+#define XboxString                 xoneXboxString
+#define ModString                  xoneModString
+#define LanguageString             xoneLanguageString
+#define ManufacturerString         xoneManufacturerString
+#define ProductString              xoneProductString
+#define SerialString               xoneSerialString
+#define CALLBACK_USB_GetDescriptor xone_get_descriptor
+
+#include "../EMUXONE/Descriptors.c"
+
+const struct persona PROGMEM xonePersona = {
+        .type = ADAPTER_TYPE,
+        .inNum = ADAPTER_IN_NUM,
+        .inSize = ADAPTER_IN_SIZE,
+        .inInterval = ADAPTER_IN_INTERVAL,
+        .outNum = ADAPTER_OUT_NUM,
+        .outSize = ADAPTER_OUT_SIZE,
+        .outInterval = ADAPTER_OUT_INTERVAL,
+        .getDescriptor = xone_get_descriptor,
+};
@@ -0,0 +1,36 @@
+/*
+ Copyright (c) 2019 Mathieu Laurendeau <mat.lau@laposte.net>
+ License: GPLv3
+ */
+
+#ifndef _PERSONA_H_
+#define _PERSONA_H_
+
+#include <stdint.h>
+
+/*
+ * Each Descriptors<persona>.c file includes the descriptors of the firmware it replaces, with its own adapter
+ * configuration, renaming them so that they don't clash with the other personas. It also sets the control endpoint
+ * size of this firmware, which LUFA reads from the device descriptor of the persona at each USB_Init().
+ */
+
+/*
+ * An emulated controller: adapter type, endpoint settings and descriptors.
+ */
+struct persona {
+    uint8_t type;
+    uint8_t inNum;
+    uint8_t inSize;
+    uint8_t inInterval;
+    uint8_t outNum;
+    uint8_t outSize;
+    uint8_t outInterval;
+    uint16_t (*getDescriptor)(const uint16_t wValue, const uint8_t wIndex, const void **const DescriptorAddress);
+};
+
+extern struct persona persona; // the selected one
+
+void Persona_Load(void);
+uint8_t Persona_Select(uint8_t type);
+
+#endif
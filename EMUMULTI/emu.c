@@ -0,0 +1,51 @@
+/*
+ Copyright (c) 2019 Mathieu Laurendeau <mat.lau@laposte.net>
+ License: GPLv3
+ */
+
+#include "../adapter_common.c"
+
+/*
+ * The control requests of the personas, renamed so that they don't clash.
+ */
+#define EVENT_USB_Device_ControlRequest ps3_control_request
+#define controlEntries ps3ControlEntries
+#include "../EMUPS3/emu.c"
+#undef EVENT_USB_Device_ControlRequest
+#undef controlEntries
+
+#define EVENT_USB_Device_ControlRequest ps4_control_request
+#define controlEntries ps4ControlEntries
+#include "../EMUPS4/emu.c"
+#undef EVENT_USB_Device_ControlRequest
+#undef controlEntries
+
+#define EVENT_USB_Device_ControlRequest x360_control_request
+#define controlEntries x360ControlEntries
+#include "../EMU360/emu.c"
+#undef EVENT_USB_Device_ControlRequest
+#undef controlEntries
+
+#define EVENT_USB_Device_ControlRequest xone_control_request
+#define controlEntries xoneControlEntries
+#include "../EMUXONE/emu.c"
+#undef EVENT_USB_Device_ControlRequest
+#undef controlEntries
+
+void EVENT_USB_Device_ControlRequest(void) {
+
+    switch (ADAPTER_TYPE) {
+    case BYTE_TYPE_SIXAXIS:
+        ps3_control_request();
+        break;
+    case BYTE_TYPE_DS4:
+        ps4_control_request();
+        break;
+    case BYTE_TYPE_X360:
+        x360_control_request();
+        break;
+    case BYTE_TYPE_XBOXONE:
+        xone_control_request();
+        break;
+    }
+}
@@ -4,6 +4,11 @@
 #include <util/delay.h>
 #include "usb_serial.h"
 #include "avr/interrupt.h"
+#include <util/atomic.h>
+#include <util/crc16.h>
+#include <string.h>
+#include "ps2.h"
+#include "ps2_protocol.h"
 
 #define LED_CONFIG	(DDRD |= (1<<6))
 #define LED_OFF		(PORTD &= ~(1<<6))
@@ -25,7 +30,16 @@
 #define DDR_SPI DDRB
 #define DD_MISO 3
 
-#define TIME_OUT_ERROR_CODE 0xAA
+//the console waits for a low pulse of at least 2us between bytes
+#define ACK_PULSE_US	3
+
+//timer 1 runs at 16MHz/64, attention not asserted for 100ms means we've been disconnected
+#define DISCONNECT_TICKS	(100000 / PS2_TIME_UNIT_US)
+
+//bytes read from usb at once, interrupts are disabled while they are copied
+#define RX_CHUNK_SIZE	16
+
+#define ACK_SIZE	5
 
 void SPI_SlaveInit(void)
 {
@@ -35,91 +49,282 @@ void SPI_SlaveInit(void)
 	/* Enable SPI */
 	SPCR = 0;
 	SPCR |= (1<<SPE);
-//	SPCR |= (1<<SPIE);//interrupts
+	SPCR |= (1<<SPIE);//interrupts
 	SPCR |= (1<<DORD);
 	SPCR |= (1<<CPOL);
 	SPCR |= (1<<CPHA);
 	
+	SPDR = PS2_IDLE;
+
+	/* Attention is on PB0, get an interrupt on both edges */
+	PCMSK0 |= (1<<PCINT0);
+	PCICR |= (1<<PCIE0);
 }
 
-char SPI_SlaveReceive(char outData, char doACK)
+//a byte has been exchanged with the console, load the next one before acking
+ISR(SPI_STC_vect)
 {
-    char inData = 0;//clear the status bit if it is pending
-	char timeout = 0;
-	
+	int16_t next = ps2_next(SPDR);
+	if(next < 0)
+	{
+		SPDR = PS2_IDLE;
+		return;
+	}
+	SPDR = next;
+	ACK_LOW;
+	_delay_us(ACK_PULSE_US);
 	ACK_HIGH;
+}
 
-	if(SPSR > 0)
+volatile uint16_t attentionTime = 0;
+
+uint16_t timer_read(void)
+{
+	uint16_t ticks;
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
 	{
-		inData = SPDR;
+		ticks = TCNT1;
 	}
-	
-	SPDR = outData;
-	TEST_LOW;
-	
-	/* Wait for reception complete */
-	while(!(SPSR & (1<<SPIF)))
+	return ticks;
+}
+
+uint16_t attention_read(void)
+{
+	uint16_t ticks;
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
 	{
-		_delay_us(1);
-		timeout++;
-		if(timeout > 200)
-		{
-			return TIME_OUT_ERROR_CODE;
-		}
+		ticks = attentionTime;
 	}
-	
-	TEST_HIGH;
+	return ticks;
+}
 
-	if(doACK)
+ISR(PCINT0_vect)
+{
+	if(!ATT_PIN)
 	{
-		ACK_LOW;
-		//ack gets pulled back high at the beginning of next call
+		SPDR = ps2_start();
+		attentionTime = TCNT1;
+	}
+	else
+	{
+		ps2_stop();
 	}
-	
-	/* Return Data Register */
-	inData = SPDR;
-	return inData;
 }
 
 int counter = 0;
 
-char buttons1 = 0xff;
-char buttons2 = 0xff;
+struct ps2_input input = { { 0xff, 0xff }, { 0x80, 0x80, 0x80, 0x80 }, { 0x00 } };
 
-//used to buffer button releases until after report has been sent to console
-char buttons1postReportState = 0xff;
-char buttons2postReportState = 0xff;
+uint8_t parseIndex = 0;
+char recievedUpdate = 0;
 
-char joyLX = 0x80;
-char joyLY = 0x80;
-char joyRX = 0x80;
-char joyRY = 0x80;
+//framed protocol, see ps2_protocol.h
+enum
+{
+	RX_START,
+	RX_LEGACY,
+	RX_SEQUENCE,
+	RX_TYPE,
+	RX_LENGTH,
+	RX_VALUE,
+	RX_CRC_LOW,
+	RX_CRC_HIGH,
+};
+
+char framed = 0;
+uint8_t rxState = RX_START;
+uint8_t rxSequence;
+uint8_t rxType;
+uint8_t rxLength;
+uint8_t rxValue[sizeof(struct ps2_input)];
+uint16_t rxCrc;
+//bytes of the frame being parsed, parsed again from the second one if the frame is dropped
+uint8_t rxFrame[PS2_FRAME_OVERHEAD + sizeof(struct ps2_input)];
+uint8_t rxFrameLength = 0;
+char rxResync = 0;
+uint8_t updateSequence = 0;
+uint8_t txSequence = 0;
+
+void send_frame(uint8_t type, const uint8_t * value, uint8_t length)
+{
+	uint8_t frame[PS2_FRAME_OVERHEAD + ACK_SIZE];
+	uint16_t crc = PS2_FRAME_CRC_INIT;
+	uint8_t i;
+
+	frame[0] = PS2_FRAME_START;
+	frame[1] = txSequence++;
+	frame[2] = type;
+	frame[3] = length;
+	if(length)
+	{
+		memcpy(frame + 4, value, length);
+	}
+	for(i = 1; i < 4 + length; i++)
+	{
+		crc = _crc_ccitt_update(crc, frame[i]);
+	}
+	frame[4 + length] = crc & 0xff;
+	frame[5 + length] = crc >> 8;
+	usb_serial_write(frame, PS2_FRAME_OVERHEAD + length);
+}
 
-char rightPressure = 0x00;
-char leftPressure = 0x00;
-char upPressure = 0x00;
-char downPressure = 0x00;
-char trianglePressure = 0x00;
-char squarePressure = 0x00;
-char crossPressure = 0x00;
-char circlePressure = 0x00;
-char L1Pressure = 0x00;
-char R1Pressure = 0x00;
-char L2Pressure = 0x00;
-char R2Pressure = 0x00;
+void apply_update(void)
+{
+	//pending presses are combined with the update
+	ps2_update(&input);
+	recievedUpdate = 1;
+}
+
+void frame_error(void)
+{
+	rxState = RX_START;
+	rxResync = 1;
+	send_frame(PS2_TYPE_ERROR, NULL, 0);
+}
 
-char configMode = 0;
-char mode = 0x41;
+void parse(uint8_t c)
+{
+	if(rxState >= RX_SEQUENCE)
+	{
+		rxFrame[rxFrameLength++] = c;
+		if(rxState < RX_CRC_LOW)
+		{
+			rxCrc = _crc_ccitt_update(rxCrc, c);
+		}
+	}
 
-char motorSetting1 = 0xff;
-char motorSetting2 = 0xff;
+	switch(rxState)
+	{
+	case RX_START:
+		if(c == PS2_FRAME_START)
+		{
+			rxFrame[0] = c;
+			rxFrameLength = 1;
+			rxCrc = PS2_FRAME_CRC_INIT;
+			rxState = RX_SEQUENCE;
+		}
+		else if(framed)
+		{
+			//resync on the next frame, legacy updates are not checked
+		}
+		else if(c == PS2_LEGACY_START)
+		{
+			parseIndex = 1;
+			rxState = RX_LEGACY;
+		}
+		else
+		{
+			usb_serial_putchar(PS2_LEGACY_ERROR);
+		}
+		break;
+	case RX_LEGACY:
+		if(parseIndex < 3)
+		{
+			input.buttons[parseIndex - 1] = c;
+		}
+		else
+		{
+			input.axes[parseIndex - 3] = c;
+		}
+		if(++parseIndex < 7)
+		{
+			break;
+		}
+		rxState = RX_START;
+		//the legacy protocol has no pressures
+		ps2_pressures_from_buttons(&input);
+		apply_update();
+		break;
+	case RX_SEQUENCE:
+		rxSequence = c;
+		rxState = RX_TYPE;
+		break;
+	case RX_TYPE:
+		rxType = c;
+		rxState = RX_LENGTH;
+		break;
+	case RX_LENGTH:
+		rxLength = c;
+		parseIndex = 0;
+		if(rxLength > sizeof(rxValue))
+		{
+			frame_error();
+			break;
+		}
+		rxState = rxLength ? RX_VALUE : RX_CRC_LOW;
+		break;
+	case RX_VALUE:
+		rxValue[parseIndex++] = c;
+		if(parseIndex == rxLength)
+		{
+			rxState = RX_CRC_LOW;
+		}
+		break;
+	case RX_CRC_LOW:
+		if(c != (rxCrc & 0xff))
+		{
+			frame_error();
+			break;
+		}
+		rxState = RX_CRC_HIGH;
+		break;
+	case RX_CRC_HIGH:
+		if(c != (rxCrc >> 8))
+		{
+			frame_error();
+			break;
+		}
+		rxState = RX_START;
+		framed = 1;
+		if(rxType == PS2_TYPE_UPDATE && rxLength == sizeof(input))
+		{
+			memcpy(&input, rxValue, sizeof(input));
+			updateSequence = rxSequence;
+			apply_update();
+		}
+		break;
+	}
+}
 
+//parse a received byte, and after a dropped frame parse it again from its second byte, as the adapters do
+void receive(uint8_t c)
+{
+	uint8_t pending[sizeof(rxFrame)];
+	uint8_t length = 0;
+	uint8_t next = 0;
 
-char analogEnabled = 0;
+	pending[length++] = c;
+	while(next < length)
+	{
+		parse(pending[next++]);
+		if(rxResync)
+		{
+			//the bytes left were received after the dropped frame, which ends with the byte just parsed
+			rxResync = 0;
+			memmove(pending + rxFrameLength - 1, pending + next, length - next);
+			memcpy(pending, rxFrame + 1, rxFrameLength - 1);
+			length = rxFrameLength - 1 + length - next;
+			next = 0;
+		}
+	}
+}
 
-char parseIndex = 0;
-char recievedUpdate = 0;
-int timeoutCounter = 0;
+//ack the update was sent to the console
+void send_ack(void)
+{
+	if(framed)
+	{
+		uint16_t pollTime = attention_read();
+		uint16_t now = timer_read();
+		uint8_t ack[ACK_SIZE] = { updateSequence, pollTime & 0xff, pollTime >> 8, now & 0xff, now >> 8 };
+		send_frame(PS2_TYPE_ACK, ack, sizeof(ack));
+	}
+	else if(recievedUpdate == 1)
+	{
+		usb_serial_putchar(PS2_LEGACY_ACK);
+	}
+	recievedUpdate = 0;
+}
 
 
 void printHex(char c)
@@ -140,15 +345,10 @@ void printHex(char c)
 
 int main(void)
 {	
-	char cmd;
-	char param1;
-	char param2;
-	char param3;
-	
-	cmd = 0;
-	param1 = 0;
-	param2 = 0;
-	param3 = 0;
+	uint8_t polls = 0;
+	uint8_t chunk[RX_CHUNK_SIZE];
+	int16_t count;
+	int16_t i;
 
 	DDRB = 0x00;
 	PORTB |= 0x01;
@@ -158,7 +358,6 @@ int main(void)
 	LED_CONFIG;
 	LED_ON;
 
-	SPI_SlaveInit();	
 	ACK_CONFIG;
 	ACK_HIGH;
 	
@@ -171,337 +370,69 @@ int main(void)
 	int flashCounter = 0;
 	char LEDstate = 1;
 
+	TCCR1A = 0;
+	TCCR1B = (1<<CS11) | (1<<CS10);
+	TCNT1 = 0;
+
+	ps2_update(&input);
+
+	SPI_SlaveInit();
+	sei();
+
 	while (1) {
 
-idle:
-		TEST_HIGH;
-		ACK_HIGH;
-		SPDR = 0xff;
-		if(ATT_PIN)
+		//frames still being sent when last updated
+		ps2_commit();
+
+		if(polls != ps2Polls)
 		{
-			timeoutCounter++;
-			if(timeoutCounter >= 30000)//we've been disconnected
+			polls = ps2Polls;
+			counter++;
+
+			//copy queued releases into button state
+			ps2_release();
+
+			if((input.buttons[0] == 0xff)&&(input.buttons[1] == 0xff))
 			{
-				mode = 0x41;
-				motorSetting1 = 0xff;
-				motorSetting2 = 0xff;
-				analogEnabled = 0;
-				configMode = 0;
-				timeoutCounter = 0;
-				flashCounter++;
-				if(flashCounter > 5)
-				{
-					if(LEDstate == 1)
-					{
-						LED_OFF;
-						LEDstate = 0;
-					}
-					else
-					{
-						LED_ON;
-						LEDstate = 1;	
-					}
-					flashCounter = 0;
-					
-				}
+				LED_OFF;
 			}
-			if(usb_serial_available())
+
+			send_ack();
+		}
+
+		if((uint16_t)(timer_read() - attention_read()) >= DISCONNECT_TICKS)//we've been disconnected
+		{
+			ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+			{
+				ps2_reset();
+				attentionTime = TCNT1;
+			}
+			flashCounter++;
+			if(flashCounter > 5)
 			{
-				LED_ON;
-				int c = usb_serial_getchar();
-				if (c >= 0) 
+				if(LEDstate == 1)
 				{
-					switch(parseIndex)
-					{
-					case 0:
-						if(c == 0x5A)
-							parseIndex++;
-						else
-							usb_serial_putchar('x');
-						break;
-					case 1:
-						buttons1 &= c;//combine this with any pending presses
-						buttons1postReportState = c;
-						parseIndex++;
-						break;
-					case 2:
-						buttons2 &= c;//combine this with any pending presses
-						buttons2postReportState = c;
-						parseIndex++;
-						break;
-					case 3:
-						joyRX = c;
-						parseIndex++;
-						break;
-					case 4:
-						joyRY = c;
-						parseIndex++;
-						break;
-					case 5:
-						joyLX = c;
-						parseIndex++;
-						break;
-					case 6:
-						joyLY = c;
-						parseIndex = 0;
-						recievedUpdate = 1;
-						break;
-					}
+					LED_OFF;
+					LEDstate = 0;
 				}
 				else
 				{
-					parseIndex = 0;
-					usb_serial_putchar('x');
+					LED_ON;
+					LEDstate = 1;	
 				}
+				flashCounter = 0;
+				
 			}
-			_delay_us(1);
-			goto idle;
 		}
-		timeoutCounter = 0;
-		
-		if((buttons1 & 0x10) == 0) upPressure = 0xFF; else upPressure = 0x00;
-		if((buttons1 & 0x20) == 0) rightPressure = 0xFF; else rightPressure = 0x00;
-		if((buttons1 & 0x40) == 0) downPressure = 0xFF; else downPressure = 0x00;
-		if((buttons1 & 0x80) == 0) leftPressure = 0xFF; else leftPressure = 0x00;
-		if((buttons2 & 0x01) == 0) L2Pressure = 0xFF; else L2Pressure = 0x00;
-		if((buttons2 & 0x02) == 0) R2Pressure = 0xFF; else R2Pressure = 0x00;
-		if((buttons2 & 0x04) == 0) L1Pressure = 0xFF; else L1Pressure = 0x00;
-		if((buttons2 & 0x08) == 0) R1Pressure = 0xFF; else R1Pressure = 0x00;
-		if((buttons2 & 0x10) == 0) trianglePressure = 0xFF; else trianglePressure = 0x00;
-		if((buttons2 & 0x20) == 0) circlePressure = 0xFF; else circlePressure = 0x00;
-		if((buttons2 & 0x40) == 0) crossPressure = 0xFF; else crossPressure = 0x00;
-		if((buttons2 & 0x80) == 0) squarePressure = 0xFF; else squarePressure = 0x00;
-
-		cli();//disable usb interrupts
-		LED_ON;
-		TEST_LOW;
-		cmd = SPI_SlaveReceive(0xff,1);		
-		TEST_HIGH;
-		
-		if(cmd != 0x01)
-			goto finish;
-		
-		if(configMode)
+
+		count = usb_serial_read(chunk, sizeof(chunk));
+		if(count > 0)
 		{
-			cmd = SPI_SlaveReceive(0xF3,1);		
-			SPI_SlaveReceive(0x5A,1);
-			switch(cmd)
+			LED_ON;
+			for(i = 0; i < count; i++)
 			{
-				case 0x40:
-					param1 = SPI_SlaveReceive(0x00,1);
-//					if(param1 == 0) //lots on param1 but the reponses are all the same?
-					{
-						SPI_SlaveReceive(0x00,1);
-						SPI_SlaveReceive(0x02,1);
-						SPI_SlaveReceive(0x00,1);
-						SPI_SlaveReceive(0x00,1);
-						SPI_SlaveReceive(0x5A,0);
-					}
-					break;
-				case 0x41://check response data
-					if(analogEnabled==1)
-					{
-						//button pressures byte mask, appears after 0x44 is called
-						SPI_SlaveReceive(0xFF,1);//use mask instead?
-						SPI_SlaveReceive(0xFF,1);
-						SPI_SlaveReceive(0x03,1);
-						SPI_SlaveReceive(0x00,1);
-						SPI_SlaveReceive(0x00,1);
-						SPI_SlaveReceive(0x5A,0);
-					}
-					else
-					{
-						SPI_SlaveReceive(0x00,1);
-						SPI_SlaveReceive(0x00,1);
-						SPI_SlaveReceive(0x00,1);
-						SPI_SlaveReceive(0x00,1);
-						SPI_SlaveReceive(0x00,1);
-						SPI_SlaveReceive(0x00,0);
-					}
-					break;
-				case 0x43://exit config mode
-					param1 = SPI_SlaveReceive(0x00,1);
-					SPI_SlaveReceive(0x00,1);
-					SPI_SlaveReceive(0x00,1);
-					SPI_SlaveReceive(0x00,1);
-					SPI_SlaveReceive(0x00,1);
-					SPI_SlaveReceive(0x00,0);
-					if(param1 == 0)
-					{
-						configMode = 0;
-					}
-					break;
-				case 0x44://turn on analog mode
-					param1 = SPI_SlaveReceive(0x00,1);
-					param2 = SPI_SlaveReceive(0x00,1);
-					SPI_SlaveReceive(0x00,1);
-					SPI_SlaveReceive(0x00,1);
-					SPI_SlaveReceive(0x00,1);
-					SPI_SlaveReceive(0x00,0);
-					if(param1 == 1)
-					{
-						mode = 0x73;//no analog button pressures
-						analogEnabled = 1;
-					}
-					else
-					{
-						mode = 0x41;	
-						analogEnabled = 0;
-					}
-					break;
-				case 0x45://query model
-					param1 = SPI_SlaveReceive(0x03,1);
-					param2 = SPI_SlaveReceive(0x02,1);
-					if(analogEnabled==1)
-						SPI_SlaveReceive(0x01,1);
-					else
-						SPI_SlaveReceive(0x00,1);
-					SPI_SlaveReceive(0x02,1);
-					SPI_SlaveReceive(0x01,1);
-					SPI_SlaveReceive(0x00,0);
-					break;
-				case 0x46:
-					param1 = SPI_SlaveReceive(0x00,1);
-					if(param1 == 0)
-					{
-						param2 = SPI_SlaveReceive(0x00,1);
-						SPI_SlaveReceive(0x01,1);
-						SPI_SlaveReceive(0x02,1);
-						SPI_SlaveReceive(0x00,1);
-						SPI_SlaveReceive(0x0F,0);
-					}
-					if(param1 == 1)
-					{
-						param2 = SPI_SlaveReceive(0x00,1);
-						SPI_SlaveReceive(0x01,1);
-						SPI_SlaveReceive(0x01,1);
-						SPI_SlaveReceive(0x01,1);
-						SPI_SlaveReceive(0x0F,0);
-					}
-					break;
-				case 0x47:
-					SPI_SlaveReceive(0x00,1);
-					SPI_SlaveReceive(0x00,1);
-					SPI_SlaveReceive(0x02,1);
-					SPI_SlaveReceive(0x00,1);
-					SPI_SlaveReceive(0x01,1);
-					SPI_SlaveReceive(0x00,0);
-					break;
-				case 0x4C:
-					param1 = SPI_SlaveReceive(0x00,1);
-					if(param1 == 0)
-					{
-						SPI_SlaveReceive(0x00,1);
-						SPI_SlaveReceive(0x00,1);
-						SPI_SlaveReceive(0x04,1);
-						SPI_SlaveReceive(0x00,1);
-						SPI_SlaveReceive(0x00,0);
-					}
-					if(param1 == 1)
-					{
-						SPI_SlaveReceive(0x00,1);
-						SPI_SlaveReceive(0x00,1);
-						SPI_SlaveReceive(0x07,1);
-						SPI_SlaveReceive(0x00,1);
-						SPI_SlaveReceive(0x00,0);
-					}
-					break;
-				case 0x4D://setup motors
-					motorSetting1 = SPI_SlaveReceive(motorSetting1,1);
-					motorSetting2 = SPI_SlaveReceive(motorSetting2,1);
-					SPI_SlaveReceive(0xFF,1);
-					SPI_SlaveReceive(0xFF,1);
-					SPI_SlaveReceive(0xFF,1);
-					SPI_SlaveReceive(0xFF,0);
-					break;
-				case 0x4F://set pressure byte mask, extended pressures
-					mode = 0x79;//analog button pressures
-					param1 = SPI_SlaveReceive(0x00,1);
-					param2 = SPI_SlaveReceive(0x00,1);
-					param3 = SPI_SlaveReceive(0x00,1);
-					SPI_SlaveReceive(0x00,1);
-					SPI_SlaveReceive(0x00,1);
-					SPI_SlaveReceive(0x5A,0);
-					break;
+				receive(chunk[i]);
 			}
 		}
-		else
-		{
-			TEST_LOW;
-			cmd = SPI_SlaveReceive(mode,1);	
-			
-			SPI_SlaveReceive(0x5A,1);
-			
-			if(mode == 0x41)//digital only
-			{
-				param1 = SPI_SlaveReceive(buttons1,1);
-				param2 = SPI_SlaveReceive(buttons2,0);
-			}
-			if(mode == 0x73)//digital buttons, analog joysticks
-			{
-				param1 = SPI_SlaveReceive(buttons1,1);
-				if(param1 ==TIME_OUT_ERROR_CODE) goto finish;
-				if(SPI_SlaveReceive(buttons2,1)==TIME_OUT_ERROR_CODE) goto finish;
-				if(SPI_SlaveReceive(joyRX,1)==TIME_OUT_ERROR_CODE) goto finish;
-				if(SPI_SlaveReceive(joyRY,1)==TIME_OUT_ERROR_CODE) goto finish;
-				if(SPI_SlaveReceive(joyLX,1)==TIME_OUT_ERROR_CODE) goto finish;
-				if(SPI_SlaveReceive(joyLY,0)==TIME_OUT_ERROR_CODE) goto finish;
-			}
-			if(mode == 0x79)//analog joysticks, analog buttons
-			{
-				param1 = SPI_SlaveReceive(buttons1,1);
-				if(param1 ==TIME_OUT_ERROR_CODE) goto finish;
-				if(SPI_SlaveReceive(buttons2,1)==TIME_OUT_ERROR_CODE) goto finish;
-				if(SPI_SlaveReceive(joyRX,1)==TIME_OUT_ERROR_CODE) goto finish;
-				if(SPI_SlaveReceive(joyRY,1)==TIME_OUT_ERROR_CODE) goto finish;
-				if(SPI_SlaveReceive(joyLX,1)==TIME_OUT_ERROR_CODE) goto finish;
-				if(SPI_SlaveReceive(joyLY,1)==TIME_OUT_ERROR_CODE) goto finish;
-				if(SPI_SlaveReceive(rightPressure,1)==TIME_OUT_ERROR_CODE) goto finish;
-				if(SPI_SlaveReceive(leftPressure,1)==TIME_OUT_ERROR_CODE) goto finish;
-				if(SPI_SlaveReceive(upPressure,1)==TIME_OUT_ERROR_CODE) goto finish;
-				if(SPI_SlaveReceive(downPressure,1)==TIME_OUT_ERROR_CODE) goto finish;
-				if(SPI_SlaveReceive(trianglePressure,1)==TIME_OUT_ERROR_CODE) goto finish;
-				if(SPI_SlaveReceive(circlePressure,1)==TIME_OUT_ERROR_CODE) goto finish;
-				if(SPI_SlaveReceive(crossPressure,1)==TIME_OUT_ERROR_CODE) goto finish;
-				if(SPI_SlaveReceive(squarePressure,1)==TIME_OUT_ERROR_CODE) goto finish;
-				if(SPI_SlaveReceive(L1Pressure,1)==TIME_OUT_ERROR_CODE) goto finish;
-				if(SPI_SlaveReceive(R1Pressure,1)==TIME_OUT_ERROR_CODE) goto finish;
-				if(SPI_SlaveReceive(L2Pressure,1)==TIME_OUT_ERROR_CODE) goto finish;
-				if(SPI_SlaveReceive(R2Pressure,0)==TIME_OUT_ERROR_CODE) goto finish;
-			}
-			//cmd should usually be 0x42 for polling
-			if(cmd == 0x43)
-			{
-				if(param1 == 0x01)
-					configMode = 1;
-			}
-		}
-finish:
-		TEST_HIGH;
-		ACK_HIGH;
-		if((buttons1 == 0xff)&&(buttons2 == 0xff))
-		{
-			LED_OFF;
-		}
-
-		//copy queued releases into button state
-		buttons1 = buttons1postReportState;
-		buttons2 = buttons2postReportState;
-		sei();//renable usb interrupts
-		
-		if(recievedUpdate == 1)
-		{
-			//ack the update was sent to the console
-			usb_serial_putchar('k');
-			recievedUpdate = 0;
-		}
-
-		while(!ATT_PIN)
-		{
-			_delay_us(20); //conservative so we aren't still in ATT low at the top of the loop		
-		}
-
-		
-		counter++;
 	}
-}
\ No newline at end of file
+}
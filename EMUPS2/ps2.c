@@ -0,0 +1,336 @@
+/*
+ Copyright (c) 2019 Mathieu Laurendeau <mat.lau@laposte.net>
+ License: GPLv3
+ */
+
+#include "ps2.h"
+
+#include <string.h>
+
+#define PS2_HEADER_SIZE   3
+#define PS2_FRAME_MAX_SIZE (PS2_HEADER_SIZE + 18)
+#define PS2_CONFIG_SIZE   (PS2_HEADER_SIZE + 6)
+
+#define PS2_READY         0x5a
+
+#define PS2_CMD_ENTER_EXIT_CONFIG 0x43
+#define PS2_CMD_SET_MODE          0x44
+
+/*
+ * Keeps the compiler from moving the frame writes after the buffer swap.
+ */
+#define PS2_BARRIER() __asm__ __volatile__ ("" ::: "memory")
+
+enum {
+    PS2_MODE_INDEX_DIGITAL,
+    PS2_MODE_INDEX_ANALOG,
+    PS2_MODE_INDEX_PRESSURE,
+    PS2_MODES
+};
+
+static const struct {
+    uint8_t id;
+    uint8_t size;
+} modes[PS2_MODES] = {
+    [PS2_MODE_INDEX_DIGITAL] = { PS2_MODE_DIGITAL, PS2_HEADER_SIZE + 2 },
+    [PS2_MODE_INDEX_ANALOG] = { PS2_MODE_ANALOG, PS2_HEADER_SIZE + 6 },
+    [PS2_MODE_INDEX_PRESSURE] = { PS2_MODE_PRESSURE, PS2_FRAME_MAX_SIZE },
+};
+
+/*
+ * Bits of the pressure sensitive buttons, in poll order.
+ */
+static const struct {
+    uint8_t byte;
+    uint8_t mask;
+} pressureBits[PS2_PRESSURES] = {
+    { 0, 0x20 }, // right
+    { 0, 0x80 }, // left
+    { 0, 0x10 }, // up
+    { 0, 0x40 }, // down
+    { 1, 0x10 }, // triangle
+    { 1, 0x20 }, // circle
+    { 1, 0x40 }, // cross
+    { 1, 0x80 }, // square
+    { 1, 0x04 }, // L1
+    { 1, 0x08 }, // R1
+    { 1, 0x01 }, // L2
+    { 1, 0x02 }, // R2
+};
+
+/*
+ * Complete poll responses for each mode, built from host updates by the main loop.
+ * A transaction sends from the front buffer it started with, the main loop builds into the back buffer then swaps.
+ */
+static uint8_t frames[2][PS2_MODES][PS2_FRAME_MAX_SIZE];
+static volatile uint8_t front = 0;
+static uint8_t dirty = 0;
+
+static struct ps2_input current = { { 0xff, 0xff }, { 0x80, 0x80, 0x80, 0x80 }, { 0x00 } };
+
+/*
+ * Buttons in the poll data, which also hold the presses the console has not seen yet.
+ */
+static uint8_t latched[2] = { 0xff, 0xff };
+
+static uint8_t mode = PS2_MODE_INDEX_DIGITAL;
+static uint8_t config = 0;
+static uint8_t analog = 0;
+static uint8_t motors[2] = { 0xff, 0xff };
+
+static volatile uint8_t active = 0;
+static volatile uint8_t buffer = 0;
+static uint8_t position = 0;
+static uint8_t command = 0;
+static const uint8_t * data = NULL;
+static uint8_t length = 0;
+static uint8_t reply[PS2_CONFIG_SIZE] = { PS2_IDLE, PS2_MODE_CONFIG, PS2_READY };
+
+volatile uint8_t ps2Polls = 0;
+
+static void build_frames(uint8_t (* modeFrames)[PS2_FRAME_MAX_SIZE]) {
+
+    uint8_t * frame = modeFrames[PS2_MODE_INDEX_PRESSURE];
+    uint8_t * pressures = frame + PS2_HEADER_SIZE + 2 + sizeof(current.axes);
+
+    frame[0] = PS2_IDLE;
+    frame[1] = modes[PS2_MODE_INDEX_PRESSURE].id;
+    frame[2] = PS2_READY;
+    frame[3] = latched[0];
+    frame[4] = latched[1];
+    memcpy(frame + 5, current.axes, sizeof(current.axes));
+    uint8_t i;
+    for (i = 0; i < PS2_PRESSURES; ++i) {
+        pressures[i] = current.pressures[i];
+        // a press the console has not seen yet
+        if (pressures[i] == 0x00 && !(latched[pressureBits[i].byte] & pressureBits[i].mask)) {
+            pressures[i] = 0xff;
+        }
+    }
+
+    for (i = 0; i < PS2_MODE_INDEX_PRESSURE; ++i) {
+        memcpy(modeFrames[i], frame, modes[i].size);
+        modeFrames[i][1] = modes[i].id;
+    }
+}
+
+void ps2_reset(void) {
+
+    mode = PS2_MODE_INDEX_DIGITAL;
+    config = 0;
+    analog = 0;
+    motors[0] = 0xff;
+    motors[1] = 0xff;
+    active = 0;
+}
+
+/*
+ * Publishes the pending changes, unless the back buffer is still being sent.
+ * Called from the main loop until it succeeds.
+ */
+void ps2_commit(void) {
+
+    if (!dirty) {
+        return;
+    }
+    uint8_t back = front ^ 1;
+    if (active && buffer == back) {
+        return;
+    }
+    build_frames(frames[back]);
+    PS2_BARRIER();
+    front = back;
+    dirty = 0;
+}
+
+void ps2_update(const struct ps2_input * input) {
+
+    current = *input;
+    latched[0] &= input->buttons[0];
+    latched[1] &= input->buttons[1];
+    dirty = 1;
+    ps2_commit();
+}
+
+/*
+ * Once a poll has been sent, release the buttons the host released meanwhile.
+ */
+void ps2_release(void) {
+
+    if (latched[0] == current.buttons[0] && latched[1] == current.buttons[1]) {
+        return;
+    }
+    latched[0] = current.buttons[0];
+    latched[1] = current.buttons[1];
+    dirty = 1;
+    ps2_commit();
+}
+
+/*
+ * For hosts that only send digital buttons.
+ */
+void ps2_pressures_from_buttons(struct ps2_input * input) {
+
+    uint8_t i;
+    for (i = 0; i < PS2_PRESSURES; ++i) {
+        input->pressures[i] = (input->buttons[pressureBits[i].byte] & pressureBits[i].mask) ? 0x00 : 0xff;
+    }
+}
+
+static void config_command(void) {
+
+    uint8_t * params = reply + PS2_HEADER_SIZE;
+
+    memset(params, 0x00, PS2_CONFIG_SIZE - PS2_HEADER_SIZE);
+    switch (command) {
+    case 0x40:
+        params[2] = 0x02;
+        params[5] = PS2_READY;
+        break;
+    case 0x41: // pressure mask
+        if (analog) {
+            params[0] = 0xff;
+            params[1] = 0xff;
+            params[2] = 0x03;
+            params[5] = PS2_READY;
+        }
+        break;
+    case 0x45: // model
+        params[0] = 0x03;
+        params[1] = 0x02;
+        params[2] = analog;
+        params[3] = 0x02;
+        params[4] = 0x01;
+        break;
+    case 0x47:
+        params[2] = 0x02;
+        params[4] = 0x01;
+        break;
+    case 0x4d: // motors
+        params[0] = motors[0];
+        params[1] = motors[1];
+        memset(params + 2, 0xff, PS2_CONFIG_SIZE - PS2_HEADER_SIZE - 2);
+        break;
+    case 0x4f: // pressures
+        mode = PS2_MODE_INDEX_PRESSURE;
+        params[5] = PS2_READY;
+        break;
+    }
+}
+
+static void config_parameter(uint8_t index, uint8_t in) {
+
+    uint8_t * params = reply + PS2_HEADER_SIZE;
+
+    switch (command) {
+    case PS2_CMD_ENTER_EXIT_CONFIG:
+        if (index == 0 && in == 0x00) {
+            config = 0;
+        }
+        break;
+    case 0x40: // pressure configuration of a button
+        if (index == 0 && in >= PS2_PRESSURES) {
+            params[2] = 0xff;
+            params[5] = 0xff;
+        }
+        break;
+    case PS2_CMD_SET_MODE:
+        if (index == 0) {
+            analog = (in == 0x01);
+            mode = analog ? PS2_MODE_INDEX_ANALOG : PS2_MODE_INDEX_DIGITAL;
+            // also unmaps the motors
+            motors[0] = 0xff;
+            motors[1] = 0xff;
+        }
+        break;
+    case 0x46:
+        if (index == 0 && in <= 0x01) {
+            params[2] = 0x01;
+            params[3] = 0x02 - in;
+            params[4] = in;
+            params[5] = 0x0f;
+        }
+        break;
+    case 0x4c:
+        if (index == 0 && in <= 0x01) {
+            params[3] = in ? 0x07 : 0x04;
+        }
+        break;
+    case 0x4d:
+        if (index < sizeof(motors)) {
+            motors[index] = in;
+        }
+        break;
+    }
+}
+
+/*
+ * Attention asserted: returns the first byte to send.
+ */
+uint8_t ps2_start(void) {
+
+    buffer = front;
+    active = 1;
+    position = 0;
+    return PS2_IDLE;
+}
+
+/*
+ * Attention released, possibly in the middle of a transaction.
+ */
+void ps2_stop(void) {
+
+    active = 0;
+}
+
+/*
+ * Byte received: returns the next byte to send, which the console has to be acknowledged for,
+ * or -1 at the end of the transaction.
+ */
+int16_t ps2_next(uint8_t in) {
+
+    if (!active) {
+        return -1;
+    }
+
+    uint8_t i = position++;
+
+    switch (i) {
+    case 0:
+        if (in != PS2_ADDRESS) {
+            break; // not for the controller
+        }
+        if (config) {
+            data = reply;
+            length = sizeof(reply);
+        } else {
+            data = frames[buffer][mode];
+            length = modes[mode].size;
+        }
+        return data[1];
+    case 1:
+        command = in;
+        if (data == reply) {
+            config_command();
+        }
+        return data[2];
+    default:
+        if (i >= PS2_HEADER_SIZE) {
+            if (data == reply) {
+                config_parameter(i - PS2_HEADER_SIZE, in);
+            } else if (i == PS2_HEADER_SIZE && command == PS2_CMD_ENTER_EXIT_CONFIG && in == 0x01) {
+                config = 1;
+            }
+        }
+        if (++i < length) {
+            return data[i];
+        }
+        if (data != reply) {
+            ++ps2Polls;
+        }
+        break;
+    }
+
+    active = 0;
+    return -1;
+}
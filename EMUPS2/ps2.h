@@ -0,0 +1,53 @@
+/*
+ Copyright (c) 2019 Mathieu Laurendeau <mat.lau@laposte.net>
+ License: GPLv3
+ */
+
+#ifndef _PS2_H_
+#define _PS2_H_
+
+#include <stdint.h>
+
+/*
+ * PS2 controller protocol, slave side.
+ *
+ * The state machine is fed one byte at a time from the SPI interrupt, and returns the byte to load for the next
+ * transfer. It does not touch the hardware, so that it can also be built for the host.
+ */
+
+#define PS2_MODE_DIGITAL  0x41
+#define PS2_MODE_ANALOG   0x73
+#define PS2_MODE_PRESSURE 0x79
+#define PS2_MODE_CONFIG   0xf3
+
+#define PS2_ADDRESS       0x01
+#define PS2_IDLE          0xff
+
+#define PS2_PRESSURES     12
+
+/*
+ * Buttons are active low, axes are centered on 0x80, pressures range from 0x00 (released) to 0xff.
+ */
+struct ps2_input {
+    uint8_t buttons[2];
+    uint8_t axes[4]; // right x, right y, left x, left y
+    uint8_t pressures[PS2_PRESSURES]; // right, left, up, down, triangle, circle, cross, square, L1, R1, L2, R2
+};
+
+/*
+ * Completed polls, for the main loop to detect transactions.
+ */
+extern volatile uint8_t ps2Polls;
+
+void ps2_reset(void);
+void ps2_update(const struct ps2_input * input);
+void ps2_release(void);
+void ps2_commit(void);
+
+void ps2_pressures_from_buttons(struct ps2_input * input);
+
+uint8_t ps2_start(void);
+void ps2_stop(void);
+int16_t ps2_next(uint8_t in);
+
+#endif
@@ -0,0 +1,58 @@
+/*
+ Copyright (c) 2019 Mathieu Laurendeau <mat.lau@laposte.net>
+ License: GPLv3
+ */
+
+#ifndef _PS2_PROTOCOL_H_
+#define _PS2_PROTOCOL_H_
+
+/*
+ * Host protocol of the PS2 emulator, over USB CDC.
+ *
+ * Legacy stream: PS2_LEGACY_START | buttons (2 bytes) | right x | right y | left x | left y
+ * The emulator replies 'k' after the first console poll following an update, and 'x' on a bad start byte.
+ *
+ * Framed protocol, selected by the host sending a frame instead of a legacy update, with the same layout and CRC
+ * as the adapter protocol framing (see adapter_protocol.h):
+ *
+ * PS2_FRAME_START | sequence | type | length | value | CRC (2 bytes, little-endian)
+ *
+ * The sequence number is incremented at each frame, in each direction.
+ * The CRC is avr-libc's _crc_ccitt_update() starting from PS2_FRAME_CRC_INIT, over the sequence, type, length and
+ * value bytes. Bad frames are dropped, and the receiver resynchronizes on the next PS2_FRAME_START, starting right
+ * after the start byte of the dropped frame. After a good frame from the host, the emulator ignores legacy updates.
+ * Several frames can be sent in the same USB transfer.
+ */
+
+#define PS2_LEGACY_START    0x5a
+#define PS2_LEGACY_ACK      'k'
+#define PS2_LEGACY_ERROR    'x'
+
+#define PS2_FRAME_START     0xa5
+#define PS2_FRAME_CRC_INIT  0xffff
+#define PS2_FRAME_OVERHEAD  6
+
+/*
+ * Host to emulator, the value is a struct ps2_input:
+ * buttons (2 bytes, active low) | right x | right y | left x | left y | 12 pressures (see ps2.h)
+ */
+#define PS2_TYPE_UPDATE     0x01
+
+/*
+ * Emulator to host, after each console poll:
+ * sequence of the last update | poll time | ack time
+ *
+ * Times are 2 bytes, little-endian, in PS2_TIME_UNIT_US units of a free-running clock: the poll time is when the
+ * console asserted attention, the ack time is when the ack is sent. Hosts can phase-lock their updates to the
+ * console polls, right before the next one.
+ */
+#define PS2_TYPE_ACK        0x02
+
+/*
+ * Emulator to host, without value: a bad frame was dropped.
+ */
+#define PS2_TYPE_ERROR      0x03
+
+#define PS2_TIME_UNIT_US    4
+
+#endif
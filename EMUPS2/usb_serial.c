@@ -368,6 +368,39 @@ int16_t usb_serial_getchar(void)
 	return c;
 }
 
+// receive up to size bytes, without waiting, returns the number of bytes
+// read (-1 if not configured).  Interrupts are disabled while copying,
+// so callers should keep size small.
+int16_t usb_serial_read(uint8_t *buffer, uint16_t size)
+{
+	uint8_t c, intr_state;
+	uint16_t count=0;
+
+	intr_state = SREG;
+	cli();
+	if (!usb_configuration) {
+		SREG = intr_state;
+		return -1;
+	}
+	UENUM = CDC_RX_ENDPOINT;
+	while (count < size) {
+		c = UEINTX;
+		if (!(c & (1<<RWAL))) {
+			// no data in buffer
+			if (c & (1<<RXOUTI)) {
+				UEINTX = 0x6B;
+				continue;
+			}
+			break;
+		}
+		buffer[count++] = UEDATX;
+		// if buffer completely used, release it
+		if (!(UEINTX & (1<<RWAL))) UEINTX = 0x6B;
+	}
+	SREG = intr_state;
+	return count;
+}
+
 // number of bytes available in the receive buffer
 uint8_t usb_serial_available(void)
 {
@@ -9,6 +9,7 @@ uint8_t usb_configured(void);		// is the USB port configured
 
 // receiving data
 int16_t usb_serial_getchar(void);	// receive a character (-1 if timeout/error)
+int16_t usb_serial_read(uint8_t *buffer, uint16_t size); // receive a buffer, do not wait
 uint8_t usb_serial_available(void);	// number of bytes in receive buffer
 void usb_serial_flush_input(void);	// discard any buffered input
 
@@ -0,0 +1,14 @@
+#ifndef _ADAPTER_CONFIG_H_
+#define _ADAPTER_CONFIG_H_
+
+/*
+ * The console is served over SPI, and polls about every 16ms (NTSC) or 20ms (PAL).
+ * IN reports are a struct ps2_input (see ../EMUPS2/ps2.h), or its first 6 bytes for digital hosts.
+ */
+#define ADAPTER_NO_USB
+#define ADAPTER_TYPE         BYTE_TYPE_PS2
+#define ADAPTER_IN_NUM       (ENDPOINT_DIR_IN | 1) // not enumerated
+#define ADAPTER_IN_SIZE      18
+#define ADAPTER_IN_INTERVAL  20
+
+#endif
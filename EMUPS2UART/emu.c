@@ -0,0 +1,119 @@
+/*
+ Copyright (c) 2019 Mathieu Laurendeau <mat.lau@laposte.net>
+ License: GPLv3
+ */
+
+#include "../adapter_common.c"
+#include "../EMUPS2/ps2.h"
+
+#include <stddef.h>
+#include <avr/interrupt.h>
+#include <util/delay.h>
+
+/*
+ * PS2 controller on the SPI slave: attention is on PB0 (SS), acknowledge on PB7.
+ * The adapter protocol runs on the USART as for the USB firmwares, and the USB controller is not used.
+ */
+
+#define ATT_PIN 0
+#define MISO_PIN 3
+#define ACK_PIN 7
+
+#define ACK_HIGH() (PORTB |= (1 << ACK_PIN))
+#define ACK_LOW() (PORTB &= ~(1 << ACK_PIN))
+
+#define ACK_PULSE_US 3 // the console waits for a low pulse of at least 2us between bytes
+
+#define DISCONNECT_TIME 25000 // 100ms at FCPU / 64 without a transaction: the console is off, or the cable unplugged
+
+#define PS2_DIGITAL_REPORT_SIZE offsetof(struct ps2_input, pressures)
+
+static volatile uint16_t attentionTime = 0; // Timer1 at the start of the last transaction
+
+static const struct ps2_input neutral = { { 0xff, 0xff }, { 0x80, 0x80, 0x80, 0x80 }, { 0x00 } };
+
+static uint8_t polls = 0;
+
+/*
+ * A byte has been exchanged with the console: load the next one, then acknowledge.
+ */
+ISR(SPI_STC_vect) {
+
+    int16_t next = ps2_next(SPDR);
+
+    if (next < 0) {
+        SPDR = PS2_IDLE;
+        return;
+    }
+    SPDR = next;
+    ACK_LOW();
+    _delay_us(ACK_PULSE_US);
+    ACK_HIGH();
+}
+
+ISR(PCINT0_vect) {
+
+    if (!(PINB & (1 << ATT_PIN))) {
+        SPDR = ps2_start();
+        attentionTime = TCNT1;
+    } else {
+        ps2_stop();
+    }
+}
+
+void Adapter_Init(void) {
+
+    PORTB |= (1 << ATT_PIN) | (1 << ACK_PIN);
+    DDRB = (1 << MISO_PIN) | (1 << ACK_PIN);
+
+    SPCR = (1 << SPE) | (1 << SPIE) | (1 << DORD) | (1 << CPOL) | (1 << CPHA);
+    SPDR = PS2_IDLE;
+
+    ps2_update(&neutral);
+
+    // attention, on both edges
+    PCMSK0 |= (1 << PCINT0);
+    PCICR |= (1 << PCIE0);
+}
+
+void Adapter_SendReport(const uint8_t * report, uint8_t len) {
+
+    struct ps2_input input = neutral;
+
+    memcpy(&input, report, len < sizeof(input) ? len : sizeof(input));
+    if (len <= PS2_DIGITAL_REPORT_SIZE) {
+        ps2_pressures_from_buttons(&input);
+    }
+    ps2_update(&input);
+}
+
+void Adapter_Task(void) {
+
+    uint16_t attention;
+
+    ps2_commit();
+
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+        attention = attentionTime;
+    }
+
+    if (polls != ps2Polls) {
+        polls = ps2Polls;
+        ps2_release();
+        Adapter_PollSeen(attention);
+    } else if ((uint16_t) (timer_read() - attention) >= DISCONNECT_TIME) {
+        ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+            ps2_reset();
+            attentionTime = timer_read();
+        }
+    }
+}
+
+/*
+ * The adapter does not enumerate, this is only here for the LUFA device code.
+ */
+uint16_t CALLBACK_USB_GetDescriptor(const uint16_t wValue, const uint8_t wIndex, const void **const DescriptorAddress) {
+
+    *DescriptorAddress = NULL;
+    return NO_DESCRIPTOR;
+}
@@ -159,10 +159,27 @@ const uint8_t PROGMEM report_f7[] = {
     0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
 };
 
+/*
+ * Sorted by report id.
+ */
+static const struct control_entry PROGMEM controlEntries[] = {
+        FEATURE_REPLY(0x01, report_01),
+        FEATURE_REPLY(0xf2, report_f2),
+        FEATURE_REPLY(0xf7, report_f7),
+};
+
 void EVENT_USB_Device_ControlRequest(void) {
 
     static uint8_t buffer[MAX_CONTROL_TRANSFER_SIZE];
 
+    if (descriptor_request()) {
+        return;
+    }
+
+    if (CONTROL_DISPATCH(controlEntries)) {
+        return;
+    }
+
     switch (USB_ControlRequest.bRequest) {
     case REQ_GetReport:
         if (USB_ControlRequest.bmRequestType == (REQDIR_DEVICETOHOST | REQTYPE_CLASS | REQREC_INTERFACE)) {
@@ -170,20 +187,11 @@ void EVENT_USB_Device_ControlRequest(void) {
             uint8_t reportId = USB_ControlRequest.wValue & 0xff;
 
             if (reportType == REPORT_TYPE_FEATURE) {
-                const void *feature = NULL;
                 uint8_t len = 0;
 
                 switch (reportId) {
-                case 0x01:
-                    feature = report_01;
-                    len = sizeof(report_01);
-                    break;
-                case 0xf2:
-                    feature = report_f2;
-                    len = sizeof(report_f2);
-                    break;
                 case 0xf5:
-                    memcpy_P(buffer, report_f5, sizeof(buffer));
+                    memcpy_P(buffer, report_f5, sizeof(report_f5));
                     if (reply == 0) {
                         /*
                          * First request, tell that the bdaddr is not the one of the PS3.
@@ -198,33 +206,25 @@ void EVENT_USB_Device_ControlRequest(void) {
                     len = sizeof(report_f5);
                     break;
                 case 0xef:
-                    memcpy_P(buffer, report_ef, sizeof(buffer));
+                    memcpy_P(buffer, report_ef, sizeof(report_ef));
                     buffer[7] = byte_6_ef;
                     len = sizeof(report_ef);
                     break;
                 case 0xf8:
-                    memcpy_P(buffer, report_f8, sizeof(buffer));
+                    memcpy_P(buffer, report_f8, sizeof(report_f8));
                     buffer[7] = byte_6_ef; //necessary??
                     len = sizeof(report_f8);
                     break;
-                case 0xf7:
-                    feature = report_f7;
-                    len = sizeof(report_f7);
-                    break;
                 default:
-                    Serial_SendByte(BYTE_DEBUG);
-                    Serial_SendByte(BYTE_LEN_1_BYTE);
-                    Serial_SendByte(reportId);
+                    Serial_QueueByte(BYTE_DEBUG);
+                    Serial_QueueByte(BYTE_LEN_1_BYTE);
+                    Serial_QueueByte(reportId);
                     break;
                 }
 
-                if (feature) {
-                    Endpoint_ClearSETUP();
-                    Endpoint_Write_Control_PStream_LE(feature, USB_ControlRequest.wLength);
-                    Endpoint_ClearOUT();
-                } else if (len) {
+                if (len) {
                     Endpoint_ClearSETUP();
-                    Endpoint_Write_Control_Stream_LE(buffer, USB_ControlRequest.wLength);
+                    Endpoint_Write_Control_Stream_LE(buffer, len);
                     Endpoint_ClearOUT();
                 }
             }
@@ -255,10 +255,10 @@ void EVENT_USB_Device_ControlRequest(void) {
             } else if (reportType == REPORT_TYPE_OUTPUT) {
                 switch (reportId) {
                 case 0x01:
-                    Serial_SendByte(BYTE_OUT_REPORT);
-                    Serial_SendByte(USB_ControlRequest.wLength + 1);
-                    Serial_SendByte(0x01);
-                    Serial_SendData(buffer, USB_ControlRequest.wLength);
+                    Serial_QueueByte(BYTE_OUT_REPORT);
+                    Serial_QueueByte(USB_ControlRequest.wLength + 1);
+                    Serial_QueueByte(0x01);
+                    Serial_QueueData(buffer, USB_ControlRequest.wLength);
                     break;
                 }
             }
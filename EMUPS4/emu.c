@@ -18,31 +18,29 @@ const uint8_t PROGMEM buf03[] = {
         0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00
 };
 
+/*
+ * Sorted by report id.
+ */
+static const struct control_entry PROGMEM controlEntries[] = {
+        FEATURE_REPLY(0x03, buf03),
+        FEATURE_SPOOF(0xf1),
+        FEATURE_SPOOF(0xf2),
+        FEATURE_REPLY(0xf3, buff3),
+};
+
 void EVENT_USB_Device_ControlRequest(void) {
 
     static uint8_t buffer[MAX_CONTROL_TRANSFER_SIZE];
 
+    if (descriptor_request()) {
+        return;
+    }
+
+    if (CONTROL_DISPATCH(controlEntries)) {
+        return;
+    }
+
     switch (USB_ControlRequest.bRequest) {
-    case REQ_GetReport:
-        if (USB_ControlRequest.bmRequestType == (REQDIR_DEVICETOHOST | REQTYPE_CLASS | REQREC_INTERFACE)) {
-            if (USB_ControlRequest.wValue == 0x0303) {
-                Endpoint_ClearSETUP();
-                Endpoint_Write_Control_PStream_LE(buf03, sizeof(buf03));
-                Endpoint_ClearOUT();
-            } else if (USB_ControlRequest.wValue == 0x03f3) {
-                Endpoint_ClearSETUP();
-                Endpoint_Write_Control_PStream_LE(buff3, sizeof(buff3));
-                Endpoint_ClearOUT();
-            } else if (USB_ControlRequest.wValue == 0x03f1 || USB_ControlRequest.wValue == 0x03f2) {
-                spoofReply = 0;
-                send_spoof_header();
-                while (!spoofReply) {}
-                Endpoint_ClearSETUP();
-                Endpoint_Write_Control_Stream_LE(buf, spoofReplyLen);
-                Endpoint_ClearOUT();
-            }
-        }
-        break;
     case REQ_SetReport:
         if (USB_ControlRequest.bmRequestType == (REQDIR_HOSTTODEVICE | REQTYPE_CLASS | REQREC_INTERFACE)) {
             Endpoint_ClearSETUP();
@@ -51,7 +49,7 @@ void EVENT_USB_Device_ControlRequest(void) {
 
             if (USB_ControlRequest.wValue == 0x03f0) {
                 send_spoof_header();
-                Serial_SendData(buffer, USB_ControlRequest.wLength);
+                Serial_QueueData(buffer, USB_ControlRequest.wLength);
             }
         }
         break;
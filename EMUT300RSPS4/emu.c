@@ -34,14 +34,37 @@ const uint8_t PROGMEM buf4c[] = {
         0x4c, 0x00, 0x02, 0x00, 0x00, 0x00, 0x02, 0x00
 };
 
-static uint8_t buf4b[] = {
+const uint8_t PROGMEM buf4b[] = {
         0x4b, 0x54, 0xd5, 0x80, 0x00, 0x00, 0x00, 0x00
 };
 
+/*
+ * Sorted by report id.
+ */
+static const struct control_entry PROGMEM controlEntries[] = {
+        FEATURE_REPLY(0x03, buf03),
+        FEATURE_REPLY(0x4b, buf4b),
+        FEATURE_REPLY(0x4c, buf4c),
+        FEATURE_REPLY(0x4d, buf4d),
+        FEATURE_REPLY(0x4e, buf4e),
+        FEATURE_REPLY(0x4f, buf4f),
+        FEATURE_SPOOF(0xf1),
+        FEATURE_SPOOF(0xf2),
+        FEATURE_REPLY(0xf3, buff3),
+};
+
 void EVENT_USB_Device_ControlRequest(void) {
 
     static uint8_t buffer[MAX_CONTROL_TRANSFER_SIZE];
 
+    if (descriptor_request()) {
+        return;
+    }
+
+    if (CONTROL_DISPATCH(controlEntries)) {
+        return;
+    }
+
     switch (USB_ControlRequest.bRequest) {
     case REQ_GetReport:
         if (USB_ControlRequest.bmRequestType == (REQDIR_DEVICETOHOST | REQTYPE_CLASS | REQREC_INTERFACE)) {
@@ -49,70 +72,9 @@ void EVENT_USB_Device_ControlRequest(void) {
             uint8_t reportId = USB_ControlRequest.wValue & 0xff;
 
             if (reportType == REPORT_TYPE_FEATURE) {
-                const void *feature = NULL;
-                uint8_t len = 0;
-
-                switch (reportId) {
-                case 0xf1:
-                case 0xf2:
-                    spoofReply = 0;
-                    send_spoof_header();
-                    while (!spoofReply)
-                        ;
-                    Endpoint_ClearSETUP();
-                    Endpoint_Write_Control_Stream_LE(buf, spoofReplyLen);
-                    Endpoint_ClearOUT();
-                    break;
-                case 0x03:
-                    feature = buf03;
-                    len = sizeof(buf03);
-                    break;
-                case 0xf3:
-                    feature = buff3;
-                    len = sizeof(buff3);
-                    break;
-                case 0x4b:
-                    Endpoint_ClearSETUP();
-                    Endpoint_Write_Control_Stream_LE(buf4b, sizeof(buf4b));
-                    Endpoint_ClearOUT();
-                    Serial_SendByte(BYTE_DEBUG);
-                    Serial_SendByte(2);
-                    Serial_SendByte(reportId);
-                    Serial_SendByte(sizeof(buf4b));
-                    break;
-                case 0x4c:
-                    feature = buf4c;
-                    len = sizeof(buf4c);
-                    break;
-                case 0x4d:
-                    feature = buf4d;
-                    len = sizeof(buf4d);
-                    break;
-                case 0x4e:
-                    feature = buf4e;
-                    len = sizeof(buf4e);
-                    break;
-                case 0x4f:
-                    feature = buf4f;
-                    len = sizeof(buf4f);
-                    break;
-                default:
-                    Serial_SendByte(BYTE_DEBUG);
-                    Serial_SendByte(BYTE_LEN_1_BYTE);
-                    Serial_SendByte(reportId);
-                    break;
-                }
-
-                if (feature) {
-                    Endpoint_ClearSETUP();
-                    Endpoint_Write_Control_PStream_LE(feature, len);
-                    Endpoint_ClearOUT();
-
-                    Serial_SendByte(BYTE_DEBUG);
-                    Serial_SendByte(2);
-                    Serial_SendByte(reportId);
-                    Serial_SendByte(len);
-                }
+                Serial_QueueByte(BYTE_DEBUG);
+                Serial_QueueByte(BYTE_LEN_1_BYTE);
+                Serial_QueueByte(reportId);
             }
         }
         break;
@@ -129,13 +91,13 @@ void EVENT_USB_Device_ControlRequest(void) {
                 switch (reportId) {
                 case 0xf0:
                     send_spoof_header();
-                    Serial_SendData(buffer, USB_ControlRequest.wLength);
+                    Serial_QueueData(buffer, USB_ControlRequest.wLength);
                     break;
                 default:
-                    Serial_SendByte(BYTE_DEBUG);
-                    Serial_SendByte(sizeof(USB_ControlRequest) + (USB_ControlRequest.wLength & 0xFF));
-                    Serial_SendData(&USB_ControlRequest, sizeof(USB_ControlRequest));
-                    Serial_SendData(buffer, USB_ControlRequest.wLength);
+                    Serial_QueueByte(BYTE_DEBUG);
+                    Serial_QueueByte(sizeof(USB_ControlRequest) + (USB_ControlRequest.wLength & 0xFF));
+                    Serial_QueueData(&USB_ControlRequest, sizeof(USB_ControlRequest));
+                    Serial_QueueData(buffer, USB_ControlRequest.wLength);
                     break;
                 }
             }
@@ -20,31 +20,30 @@ const uint8_t PROGMEM vendor3[] = {
         0xff, 0xff, 0xff, 0xff
 };
 
+/*
+ * Sorted by bRequest, then wValue. Request 6 is vendor-defined.
+ */
+static const struct control_entry PROGMEM controlEntries[] = {
+        CONTROL_REPLY(REQDIR_DEVICETOHOST | REQTYPE_VENDOR | REQREC_INTERFACE, REQ_GetReport, 0x0100, vendor3),
+        CONTROL_REPLY(REQDIR_DEVICETOHOST | REQTYPE_VENDOR | REQREC_INTERFACE, REQ_GetReport, 0x0200, vendor2),
+        CONTROL_REPLY(REQDIR_DEVICETOHOST | REQTYPE_VENDOR | REQREC_INTERFACE, 6, 0x4200, vendor1),
+};
+
 void EVENT_USB_Device_ControlRequest(void) {
     static uint8_t buffer[MAX_CONTROL_TRANSFER_SIZE];
 
-    if (USB_ControlRequest.bmRequestType == (REQDIR_DEVICETOHOST | REQTYPE_VENDOR | REQREC_INTERFACE)) {
-        if (USB_ControlRequest.bRequest == 6) // vendor-defined request
-                {
-            if (USB_ControlRequest.wValue == 0x4200) {
-                Endpoint_ClearSETUP();
-                Endpoint_Write_Control_PStream_LE(vendor1, USB_ControlRequest.wLength);
-                Endpoint_ClearOUT();
-            }
-        } else if (USB_ControlRequest.bRequest == REQ_GetReport) {
-            if (USB_ControlRequest.wValue == 0x0200) {
-                Endpoint_ClearSETUP();
-                Endpoint_Write_Control_PStream_LE(vendor2, USB_ControlRequest.wLength);
-                Endpoint_ClearOUT();
-            } else if (USB_ControlRequest.wValue == 0x0100) {
-                Endpoint_ClearSETUP();
-                Endpoint_Write_Control_PStream_LE(vendor3, USB_ControlRequest.wLength);
-                Endpoint_ClearOUT();
-            }
-        }
-    } else if (USB_ControlRequest.bmRequestType == (REQDIR_DEVICETOHOST | REQTYPE_CLASS | REQREC_INTERFACE)) {
+    if (descriptor_request()) {
+        return;
+    }
+
+    if (CONTROL_DISPATCH(controlEntries)) {
+        return;
+    }
+
+    if (USB_ControlRequest.bmRequestType == (REQDIR_DEVICETOHOST | REQTYPE_CLASS | REQREC_INTERFACE)) {
         if (USB_ControlRequest.bRequest == REQ_GetReport) {
             if (USB_ControlRequest.wValue == 0x0100) {
+                uint8_t * report = reports[reportReady];
                 report[12] = report[14] = report[16] = report[18] = 0x80;
                 Endpoint_ClearSETUP();
                 Endpoint_Write_Control_Stream_LE(report, USB_ControlRequest.wLength);
@@ -59,9 +58,9 @@ void EVENT_USB_Device_ControlRequest(void) {
                 Endpoint_ClearIN();
 
                 uint8_t length = USB_ControlRequest.wLength & 0xff;
-                Serial_SendByte(BYTE_OUT_REPORT);
-                Serial_SendByte(length);
-                Serial_SendData(buffer, length);
+                Serial_QueueByte(BYTE_OUT_REPORT);
+                Serial_QueueByte(length);
+                Serial_QueueData(buffer, length);
             }
         }
     }
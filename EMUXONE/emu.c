@@ -15,6 +15,10 @@ const uint8_t PROGMEM request144_index_4[] = {
 
 void EVENT_USB_Device_ControlRequest(void) {
 
+    if (descriptor_request()) {
+        return;
+    }
+
     if (USB_ControlRequest.bmRequestType & REQTYPE_VENDOR) {
         if (USB_ControlRequest.bmRequestType & REQDIR_DEVICETOHOST) {
             if (USB_ControlRequest.bRequest == 144) {
@@ -0,0 +1,33 @@
+/*
+ Copyright (c) 2019 Mathieu Laurendeau <mat.lau@laposte.net>
+ License: GPLv3
+ */
+
+#ifndef _SIM_LUFA_SERIAL_H_
+#define _SIM_LUFA_SERIAL_H_
+
+/*
+ * Host stand-in for the LUFA USART driver, same semantics as LUFA/Drivers/Peripheral/AVR8/Serial_AVR8.h.
+ */
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include <avr/io.h>
+
+#define SERIAL_UBBRVAL(Baud)    ((((F_CPU / 16) + (Baud / 2)) / (Baud)) - 1)
+#define SERIAL_2X_UBBRVAL(Baud) ((((F_CPU / 8) + (Baud / 2)) / (Baud)) - 1)
+
+void Serial_Init(const uint32_t BaudRate, const bool DoubleSpeed);
+void Serial_Disable(void);
+
+/*
+ * Not inlined as in LUFA: a simulated interrupt must not split the register access sequences.
+ */
+bool Serial_IsCharReceived(void);
+bool Serial_IsSendReady(void);
+void Serial_SendByte(const char DataByte);
+int16_t Serial_ReceiveByte(void);
+void Serial_SendData(const void * Buffer, uint16_t Length);
+
+#endif
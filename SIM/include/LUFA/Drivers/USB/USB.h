@@ -0,0 +1,287 @@
+/*
+ Copyright (c) 2019 Mathieu Laurendeau <mat.lau@laposte.net>
+ License: GPLv3
+ */
+
+#ifndef _SIM_LUFA_USB_H_
+#define _SIM_LUFA_USB_H_
+
+/*
+ * Host stand-in for the subset of the LUFA device mode API used by the adapter firmwares.
+ * Types and constants match LUFA; functions are implemented by the simulated USB host in sim.c.
+ */
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <string.h>
+
+#include <avr/io.h>
+#include <avr/interrupt.h>
+#include <avr/pgmspace.h>
+
+#define ARCH_AVR8  0
+#define ARCH_UC3   1
+#define ARCH_XMEGA 2
+#define ARCH       ARCH_AVR8
+
+#if defined(USE_LUFA_CONFIG_HEADER)
+#include "LUFAConfig.h"
+#endif
+
+#define ATTR_PACKED __attribute__((packed))
+
+#define GlobalInterruptEnable()  sim_sei()
+#define GlobalInterruptDisable() sim_cli()
+
+/* Standard descriptors */
+
+#define NO_DESCRIPTOR                0
+#define USB_CONFIG_POWER_MA(mA)      ((mA) >> 1)
+#define USB_STRING_LEN(UnicodeChars) (sizeof(USB_Descriptor_Header_t) + ((UnicodeChars) << 1))
+#define VERSION_TENS(x)              (int)((int)(x) / 10)
+#define VERSION_ONES(x)              (int)((int)(x) % 10)
+#define VERSION_TENTHS(x)            (int)((int)((x) * 10) % 10)
+#define VERSION_HUNDREDTHS(x)        (int)((int)((x) * 100) % 10)
+#define VERSION_BCD(x)               ((VERSION_TENS(x) << 12) | (VERSION_ONES(x) << 8) | \
+                                      (VERSION_TENTHS(x) << 4) | (VERSION_HUNDREDTHS(x) << 0))
+#define LANGUAGE_ID_ENG              0x0409
+
+#define USB_CONFIG_ATTR_RESERVED     0x80
+#define USB_CONFIG_ATTR_SELFPOWERED  0x40
+#define USB_CONFIG_ATTR_REMOTEWAKEUP 0x20
+
+#define ENDPOINT_ATTR_NO_SYNC        (0 << 2)
+#define ENDPOINT_USAGE_DATA          (0 << 4)
+
+enum USB_DescriptorTypes_t {
+    DTYPE_Device = 0x01,
+    DTYPE_Configuration = 0x02,
+    DTYPE_String = 0x03,
+    DTYPE_Interface = 0x04,
+    DTYPE_Endpoint = 0x05,
+};
+
+enum USB_Descriptor_ClassSubclassProtocol_t {
+    USB_CSCP_NoDeviceClass = 0x00,
+    USB_CSCP_NoDeviceSubclass = 0x00,
+    USB_CSCP_NoDeviceProtocol = 0x00,
+};
+
+typedef struct {
+    uint8_t Size;
+    uint8_t Type;
+} ATTR_PACKED USB_Descriptor_Header_t;
+
+typedef struct {
+    USB_Descriptor_Header_t Header;
+    uint16_t USBSpecification;
+    uint8_t Class;
+    uint8_t SubClass;
+    uint8_t Protocol;
+    uint8_t Endpoint0Size;
+    uint16_t VendorID;
+    uint16_t ProductID;
+    uint16_t ReleaseNumber;
+    uint8_t ManufacturerStrIndex;
+    uint8_t ProductStrIndex;
+    uint8_t SerialNumStrIndex;
+    uint8_t NumberOfConfigurations;
+} ATTR_PACKED USB_Descriptor_Device_t;
+
+typedef struct {
+    USB_Descriptor_Header_t Header;
+    uint16_t TotalConfigurationSize;
+    uint8_t TotalInterfaces;
+    uint8_t ConfigurationNumber;
+    uint8_t ConfigurationStrIndex;
+    uint8_t ConfigAttributes;
+    uint8_t MaxPowerConsumption;
+} ATTR_PACKED USB_Descriptor_Configuration_Header_t;
+
+typedef struct {
+    USB_Descriptor_Header_t Header;
+    uint8_t InterfaceNumber;
+    uint8_t AlternateSetting;
+    uint8_t TotalEndpoints;
+    uint8_t Class;
+    uint8_t SubClass;
+    uint8_t Protocol;
+    uint8_t InterfaceStrIndex;
+} ATTR_PACKED USB_Descriptor_Interface_t;
+
+typedef struct {
+    USB_Descriptor_Header_t Header;
+    uint8_t EndpointAddress;
+    uint8_t Attributes;
+    uint16_t EndpointSize;
+    uint8_t PollingIntervalMS;
+} ATTR_PACKED USB_Descriptor_Endpoint_t;
+
+/*
+ * Requires -fshort-wchar, as on AVR.
+ */
+typedef struct {
+    USB_Descriptor_Header_t Header;
+    wchar_t UnicodeString[];
+} ATTR_PACKED USB_Descriptor_String_t;
+
+uint16_t CALLBACK_USB_GetDescriptor(const uint16_t wValue, const uint8_t wIndex, const void **const DescriptorAddress);
+
+/* HID class */
+
+enum HID_Descriptor_ClassSubclassProtocol_t {
+    HID_CSCP_HIDClass = 0x03,
+    HID_CSCP_NonBootSubclass = 0x00,
+    HID_CSCP_BootSubclass = 0x01,
+    HID_CSCP_NonBootProtocol = 0x00,
+};
+
+enum HID_ClassRequests_t {
+    HID_REQ_GetReport = 0x01,
+    HID_REQ_GetIdle = 0x02,
+    HID_REQ_GetProtocol = 0x03,
+    HID_REQ_SetReport = 0x09,
+    HID_REQ_SetIdle = 0x0A,
+    HID_REQ_SetProtocol = 0x0B,
+};
+
+enum HID_DescriptorTypes_t {
+    HID_DTYPE_HID = 0x21,
+    HID_DTYPE_Report = 0x22,
+};
+
+typedef struct {
+    USB_Descriptor_Header_t Header;
+    uint16_t HIDSpec;
+    uint8_t CountryCode;
+    uint8_t TotalReportDescriptors;
+    uint8_t HIDReportType;
+    uint16_t HIDReportLength;
+} ATTR_PACKED USB_HID_Descriptor_HID_t;
+
+typedef uint8_t USB_Descriptor_HIDReport_Datatype_t;
+
+/* Control requests */
+
+#define REQDIR_HOSTTODEVICE (0 << 7)
+#define REQDIR_DEVICETOHOST (1 << 7)
+#define REQTYPE_STANDARD    (0 << 5)
+#define REQTYPE_CLASS       (1 << 5)
+#define REQTYPE_VENDOR      (2 << 5)
+#define REQTYPE_MASK        (3 << 5)
+#define REQREC_DEVICE       (0 << 0)
+#define REQREC_INTERFACE    (1 << 0)
+#define REQREC_ENDPOINT     (2 << 0)
+#define REQREC_OTHER        (3 << 0)
+
+enum USB_Control_Request_t {
+    REQ_GetStatus = 0,
+    REQ_ClearFeature = 1,
+    REQ_SetFeature = 3,
+    REQ_SetAddress = 5,
+    REQ_GetDescriptor = 6,
+    REQ_SetDescriptor = 7,
+    REQ_GetConfiguration = 8,
+    REQ_SetConfiguration = 9,
+    REQ_GetInterface = 10,
+    REQ_SetInterface = 11,
+    REQ_SynchFrame = 12,
+};
+
+typedef struct {
+    uint8_t bmRequestType;
+    uint8_t bRequest;
+    uint16_t wValue;
+    uint16_t wIndex;
+    uint16_t wLength;
+} ATTR_PACKED USB_Request_Header_t;
+
+extern USB_Request_Header_t USB_ControlRequest;
+
+/* Device */
+
+enum USB_Device_States_t {
+    DEVICE_STATE_Unattached = 0,
+    DEVICE_STATE_Powered = 1,
+    DEVICE_STATE_Default = 2,
+    DEVICE_STATE_Addressed = 3,
+    DEVICE_STATE_Configured = 4,
+    DEVICE_STATE_Suspended = 5,
+};
+
+extern volatile uint8_t USB_DeviceState;
+
+void USB_Init(void);
+void USB_Disable(void);
+void USB_USBTask(void);
+
+void USB_Device_EnableSOFEvents(void);
+void USB_Device_DisableSOFEvents(void);
+uint16_t USB_Device_GetFrameNumber(void);
+
+/* Endpoints */
+
+#define ENDPOINT_DIR_MASK   0x80
+#define ENDPOINT_DIR_OUT    0x00
+#define ENDPOINT_DIR_IN     0x80
+#define ENDPOINT_EPNUM_MASK 0x0F
+#define ENDPOINT_CONTROLEP  0
+
+#define EP_TYPE_CONTROL     0x00
+#define EP_TYPE_ISOCHRONOUS 0x01
+#define EP_TYPE_BULK        0x02
+#define EP_TYPE_INTERRUPT   0x03
+
+enum Endpoint_Stream_RW_ErrorCodes_t {
+    ENDPOINT_RWSTREAM_NoError = 0,
+    ENDPOINT_RWSTREAM_EndpointStalled = 1,
+    ENDPOINT_RWSTREAM_DeviceDisconnected = 2,
+    ENDPOINT_RWSTREAM_BusSuspended = 3,
+    ENDPOINT_RWSTREAM_Timeout = 4,
+    ENDPOINT_RWSTREAM_IncompleteTransfer = 5,
+};
+
+enum Endpoint_ControlStream_RW_ErrorCodes_t {
+    ENDPOINT_RWCSTREAM_NoError = 0,
+    ENDPOINT_RWCSTREAM_HostAborted = 1,
+    ENDPOINT_RWCSTREAM_DeviceDisconnected = 2,
+    ENDPOINT_RWCSTREAM_BusSuspended = 3,
+};
+
+bool Endpoint_ConfigureEndpoint(const uint8_t Address, const uint8_t Type, const uint16_t Size, const uint8_t Banks);
+void Endpoint_SelectEndpoint(const uint8_t Address);
+uint8_t Endpoint_GetCurrentEndpoint(void);
+
+bool Endpoint_IsINReady(void);
+bool Endpoint_IsOUTReceived(void);
+bool Endpoint_IsSETUPReceived(void);
+bool Endpoint_IsReadWriteAllowed(void);
+uint16_t Endpoint_BytesInEndpoint(void);
+uint8_t Endpoint_GetBusyBanks(void);
+
+void Endpoint_ClearIN(void);
+void Endpoint_ClearOUT(void);
+void Endpoint_ClearSETUP(void);
+void Endpoint_ResetEndpoint(const uint8_t Address);
+void Endpoint_StallTransaction(void);
+
+uint8_t Endpoint_Read_8(void);
+void Endpoint_Write_8(const uint8_t Data);
+
+uint8_t Endpoint_Write_Stream_LE(const void * const Buffer, uint16_t Length, uint16_t * const BytesProcessed);
+uint8_t Endpoint_Read_Stream_LE(void * const Buffer, uint16_t Length, uint16_t * const BytesProcessed);
+
+uint8_t Endpoint_Write_Control_Stream_LE(const void * const Buffer, uint16_t Length);
+uint8_t Endpoint_Write_Control_PStream_LE(const void * const Buffer, uint16_t Length);
+uint8_t Endpoint_Read_Control_Stream_LE(void * const Buffer, uint16_t Length);
+
+/* Events implemented by the firmware */
+
+void EVENT_USB_Device_Connect(void);
+void EVENT_USB_Device_Disconnect(void);
+void EVENT_USB_Device_ConfigurationChanged(void);
+void EVENT_USB_Device_ControlRequest(void);
+void EVENT_USB_Device_StartOfFrame(void);
+
+#endif
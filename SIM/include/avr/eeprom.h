@@ -0,0 +1,24 @@
+/*
+ Copyright (c) 2019 Mathieu Laurendeau <mat.lau@laposte.net>
+ License: GPLv3
+ */
+
+#ifndef _SIM_AVR_EEPROM_H_
+#define _SIM_AVR_EEPROM_H_
+
+#include <stdint.h>
+#include <string.h>
+
+/*
+ * EEPROM variables are plain variables in their own section, which the simulation erases at start, and keeps across
+ * watchdog resets.
+ */
+
+#define EEMEM __attribute__((section("sim_eeprom")))
+
+#define eeprom_read_byte(address) (*(const uint8_t *) (address))
+#define eeprom_update_byte(address, value) (*(uint8_t *) (address) = (value))
+#define eeprom_read_block(dst, src, n) memcpy(dst, src, n)
+#define eeprom_update_block(src, dst, n) memcpy(dst, src, n)
+
+#endif
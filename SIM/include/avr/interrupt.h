@@ -0,0 +1,19 @@
+/*
+ Copyright (c) 2019 Mathieu Laurendeau <mat.lau@laposte.net>
+ License: GPLv3
+ */
+
+#ifndef _SIM_AVR_INTERRUPT_H_
+#define _SIM_AVR_INTERRUPT_H_
+
+#include "sim.h"
+
+/*
+ * Interrupt vectors are plain functions, called by the simulated hardware.
+ */
+#define ISR(vector, ...) void vector(void); void vector(void)
+
+#define cli() sim_cli()
+#define sei() sim_sei()
+
+#endif
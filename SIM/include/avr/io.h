@@ -0,0 +1,115 @@
+/*
+ Copyright (c) 2019 Mathieu Laurendeau <mat.lau@laposte.net>
+ License: GPLv3
+ */
+
+#ifndef _SIM_AVR_IO_H_
+#define _SIM_AVR_IO_H_
+
+#include <stdint.h>
+
+#include "sim.h"
+
+/*
+ * Host stand-in for the ATmega32U4 registers used by the adapter firmwares.
+ */
+
+extern volatile uint8_t MCUSR;
+
+extern volatile uint8_t PORTB, DDRB, PINB;
+extern volatile uint8_t PORTD, DDRD, PIND;
+
+/* USART1 */
+
+#define UDR1   (*sim_udr1())
+#define UCSR1A (*sim_ucsr1a())
+extern volatile uint8_t UCSR1B;
+extern volatile uint8_t UCSR1C;
+extern volatile uint16_t UBRR1;
+
+#define MPCM1  0
+#define U2X1   1
+#define UPE1   2
+#define DOR1   3
+#define FE1    4
+#define UDRE1  5
+#define TXC1   6
+#define RXC1   7
+
+#define TXB81  0
+#define RXB81  1
+#define UCSZ12 2
+#define TXEN1  3
+#define RXEN1  4
+#define UDRIE1 5
+#define TXCIE1 6
+#define RXCIE1 7
+
+#define UCPOL1 0
+#define UCSZ10 1
+#define UCSZ11 2
+
+/* Timer/Counter1 */
+
+#define TCNT1  (*sim_tcnt1())
+extern volatile uint8_t TCCR1A;
+extern volatile uint8_t TCCR1B;
+
+#define CS10   0
+#define CS11   1
+#define CS12   2
+
+/* SPI */
+
+#define SPDR   (*sim_spdr())
+extern volatile uint8_t SPCR;
+extern volatile uint8_t SPSR;
+
+#define SPR0   0
+#define SPR1   1
+#define CPHA   2
+#define CPOL   3
+#define MSTR   4
+#define DORD   5
+#define SPE    6
+#define SPIE   7
+
+#define SPI2X  0
+#define WCOL   6
+#define SPIF   7
+
+/* Pin change interrupt 0 (PB0 to PB7) */
+
+extern volatile uint8_t PCICR;
+extern volatile uint8_t PCMSK0;
+
+#define PCIE0  0
+
+#define PCINT0 0
+
+/* USB endpoint interrupt flags, of the selected endpoint (only TXINI and NAKINI are simulated) */
+
+#define UEINTX (*sim_ueintx())
+
+#define TXINI    0
+#define STALLEDI 1
+#define RXOUTI   2
+#define RXSTPI   3
+#define NAKOUTI  4
+#define RWAL     5
+#define NAKINI   6
+#define FIFOCON  7
+
+/* USB endpoint interrupt enables, of the selected endpoint (only TXINE is simulated) */
+
+#define UEIENX (*sim_ueienx())
+
+#define TXINE    0
+#define STALLEDE 1
+#define RXOUTE   2
+#define RXSTPE   3
+#define NAKOUTE  4
+#define NAKINE   6
+#define FLERRE   7
+
+#endif
@@ -0,0 +1,17 @@
+/*
+ Copyright (c) 2019 Mathieu Laurendeau <mat.lau@laposte.net>
+ License: GPLv3
+ */
+
+#ifndef _SIM_AVR_WDT_H_
+#define _SIM_AVR_WDT_H_
+
+#include "sim.h"
+
+#define WDTO_15MS 0
+
+#define wdt_enable(timeout) sim_watchdog_reset()
+#define wdt_disable()
+#define wdt_reset()
+
+#endif
@@ -0,0 +1,67 @@
+/*
+ Copyright (c) 2019 Mathieu Laurendeau <mat.lau@laposte.net>
+ License: GPLv3
+ */
+
+#ifndef _SIM_H_
+#define _SIM_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+
+/*
+ * Hooks between the stand-in AVR/LUFA headers and the simulated hardware (sim.c).
+ *
+ * Every hook advances the simulated hardware (UART wire, USB frames, scripted host) to the current time,
+ * and may run pending interrupt vectors, exactly where a real interrupt could preempt the firmware.
+ */
+
+/*
+ * Data register of the USART: reading pops the receive FIFO, writing loads the transmit buffer.
+ */
+volatile uint16_t * sim_udr1(void);
+
+/*
+ * Status register of the USART (RXC1, TXC1, UDRE1, FE1, DOR1, U2X1): writing 1 to TXC1 clears it, and U2X1 is
+ * written as on the hardware.
+ */
+volatile uint16_t * sim_ucsr1a(void);
+
+/*
+ * Data register of the SPI: reading returns the last received byte, writing loads the byte to send.
+ */
+volatile uint16_t * sim_spdr(void);
+
+/*
+ * 16-bit timer counters, running at F_CPU / prescaler selected in TCCRnB.
+ */
+volatile uint16_t * sim_tcnt1(void);
+
+/*
+ * Interrupt flags of the selected USB endpoint: writing 0 to NAKINI clears it, writing 1 has no effect.
+ */
+volatile uint8_t * sim_ueintx(void);
+
+/*
+ * Interrupt enables of the selected USB endpoint: with TXINE, USB_COM_vect is pending while the bank is free.
+ */
+volatile uint8_t * sim_ueienx(void);
+
+/*
+ * Busy wait, in the time seen by the firmware.
+ */
+void sim_delay_us(double us);
+
+/*
+ * Global interrupt flag.
+ */
+void sim_cli(void);
+void sim_sei(void);
+bool sim_irq_enabled(void);
+
+/*
+ * Watchdog reset: the simulation ends.
+ */
+void sim_watchdog_reset(void) __attribute__((noreturn));
+
+#endif
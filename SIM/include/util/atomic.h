@@ -0,0 +1,37 @@
+/*
+ Copyright (c) 2019 Mathieu Laurendeau <mat.lau@laposte.net>
+ License: GPLv3
+ */
+
+#ifndef _SIM_UTIL_ATOMIC_H_
+#define _SIM_UTIL_ATOMIC_H_
+
+#include <stdint.h>
+
+#include "sim.h"
+
+/*
+ * Same semantics as avr-libc: the block runs with interrupts disabled, and the global interrupt flag is restored
+ * (ATOMIC_RESTORESTATE) or set (ATOMIC_FORCEON) on any exit from the block.
+ */
+
+#define ATOMIC_RESTORESTATE 0
+#define ATOMIC_FORCEON      1
+
+static inline uint8_t sim_atomic_begin(uint8_t type) {
+    uint8_t restore = type == ATOMIC_FORCEON || sim_irq_enabled();
+    sim_cli();
+    return restore;
+}
+
+static inline void sim_atomic_end(const uint8_t * restore) {
+    if (*restore) {
+        sim_sei();
+    }
+}
+
+#define ATOMIC_BLOCK(type) \
+    for (uint8_t sim_atomic_restore __attribute__((cleanup(sim_atomic_end))) = sim_atomic_begin(type), \
+            sim_atomic_once = 1; sim_atomic_once; sim_atomic_once = 0)
+
+#endif
@@ -0,0 +1,301 @@
+/*
+ Copyright (c) 2019 Mathieu Laurendeau <mat.lau@laposte.net>
+ License: GPLv3
+ */
+
+/*
+ * Replays SPI captures of a console and a PS2 controller against the PS2 state machine (../EMUPS2/ps2.c).
+ *
+ * The captures are Total Phase Data Center CSV exports: each transaction has a MOSI row (console bytes) and
+ * a MISO row (controller bytes). The console bytes are fed to the state machine, and its bytes are compared
+ * with the controller ones.
+ *
+ * The poll data depends on the controller state at capture time, which is taken from the capture itself:
+ * before each poll, the buttons, sticks and pressures of the expected response are sent as a host update.
+ * The replay checks the protocol (modes, config commands, lengths, acks), not the input path.
+ * For the same reason, the motor mapping in the first 0x4d response is not checked, unless the console
+ * has set it or reset it (0x44) before in the capture.
+ *
+ * The time to prepare each byte (ps2_next, the SPI interrupt path) and to build the frames on updates
+ * (ps2_update, the main loop path) is measured with the host monotonic clock.
+ */
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+
+#include "../EMUPS2/ps2.h"
+
+#define EXIT_PASS     0
+#define EXIT_FAIL     1
+#define EXIT_USAGE    2
+
+#define MAX_BYTES     64
+#define MAX_LINE      1024
+#define MAX_REPORTED  5
+
+#define POLL_DATA_OFFSET 3
+
+#define CMD_SET_MODE     0x44
+#define CMD_MOTORS       0x4d
+#define MOTORS_OFFSET    3
+#define MOTORS_SIZE      2
+
+static int verbose = 0;
+static int iterations = 1;
+
+struct timing {
+    uint64_t calls;
+    uint64_t min;
+    uint64_t sum;
+    uint64_t max;
+};
+
+static int motors_known;
+
+static struct timing next_timing;
+static struct timing update_timing;
+
+static uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static void timing_add(struct timing * timing, uint64_t ns) {
+    if (timing->calls == 0 || ns < timing->min) {
+        timing->min = ns;
+    }
+    if (ns > timing->max) {
+        timing->max = ns;
+    }
+    timing->sum += ns;
+    ++timing->calls;
+}
+
+static void timing_print(const char * name, const struct timing * timing) {
+    if (timing->calls == 0) {
+        return;
+    }
+    printf("%-32s %10llu %10llu %10llu %10llu\n", name, (unsigned long long) timing->calls,
+            (unsigned long long) timing->min, (unsigned long long) (timing->sum / timing->calls),
+            (unsigned long long) timing->max);
+}
+
+/*
+ * Parses space-separated hex bytes, returns the count.
+ */
+static int parse_bytes(const char * text, uint8_t * bytes) {
+    int count = 0;
+    char * end;
+    while (count < MAX_BYTES) {
+        unsigned long value = strtoul(text, &end, 16);
+        if (end == text) {
+            break;
+        }
+        bytes[count++] = value;
+        text = end;
+    }
+    return count;
+}
+
+static void print_bytes(const char * label, const uint8_t * bytes, int count) {
+    int i;
+    printf("  %s", label);
+    for (i = 0; i < count; ++i) {
+        printf(" %02x", bytes[i]);
+    }
+    printf("\n");
+}
+
+/*
+ * Sends the controller state of an expected poll response as a host update.
+ */
+static void update_from_poll(const uint8_t * miso, int count) {
+    struct ps2_input input = { { 0xff, 0xff }, { 0x80, 0x80, 0x80, 0x80 }, { 0x00 } };
+    const uint8_t * data = miso + POLL_DATA_OFFSET;
+    int size = count - POLL_DATA_OFFSET;
+
+    if (size >= (int) sizeof(input.buttons)) {
+        memcpy(input.buttons, data, sizeof(input.buttons));
+    }
+    ps2_pressures_from_buttons(&input);
+    data += sizeof(input.buttons);
+    size -= sizeof(input.buttons);
+    if (size >= (int) sizeof(input.axes)) {
+        memcpy(input.axes, data, sizeof(input.axes));
+    }
+    data += sizeof(input.axes);
+    size -= sizeof(input.axes);
+    if (size >= (int) sizeof(input.pressures)) {
+        memcpy(input.pressures, data, sizeof(input.pressures));
+    }
+
+    uint64_t start = now_ns();
+    ps2_update(&input);
+    ps2_release();
+    timing_add(&update_timing, now_ns() - start);
+}
+
+/*
+ * Runs a transaction, returns 0 if the responses match.
+ */
+static int transaction(const uint8_t * mosi, const uint8_t * miso, uint8_t * response, int count) {
+    int i;
+
+    switch (count > 1 ? miso[1] : 0) {
+    case PS2_MODE_DIGITAL:
+    case PS2_MODE_ANALOG:
+    case PS2_MODE_PRESSURE:
+        update_from_poll(miso, count);
+        break;
+    }
+
+    int16_t next = ps2_start();
+    for (i = 0; i < count; ++i) {
+        response[i] = next < 0 ? PS2_IDLE : next;
+        uint64_t start = now_ns();
+        next = ps2_next(mosi[i]);
+        timing_add(&next_timing, now_ns() - start);
+    }
+    ps2_stop();
+
+    uint8_t expected[MAX_BYTES];
+    memcpy(expected, miso, count);
+    if (count > 1 && miso[1] == PS2_MODE_CONFIG) {
+        switch (mosi[1]) {
+        case CMD_MOTORS:
+            if (!motors_known && count >= MOTORS_OFFSET + MOTORS_SIZE) {
+                memcpy(expected + MOTORS_OFFSET, response + MOTORS_OFFSET, MOTORS_SIZE);
+            }
+            motors_known = 1;
+            break;
+        case CMD_SET_MODE:
+            motors_known = 1;
+            break;
+        }
+    }
+
+    if (memcmp(response, expected, count) == 0) {
+        return 0;
+    }
+    return -1;
+}
+
+/*
+ * Replays a capture, returns the number of mismatching transactions, or -1 if it can't be read.
+ */
+static int replay(const char * path, unsigned int * transactions) {
+    char line[MAX_LINE];
+    uint8_t mosi[MAX_BYTES];
+    uint8_t miso[MAX_BYTES];
+    int mosi_count = 0;
+    unsigned long index = 0;
+    int mismatches = 0;
+
+    FILE * file = fopen(path, "r");
+    if (file == NULL) {
+        perror(path);
+        return -1;
+    }
+
+    /* a capture starts with the controller disconnected */
+    ps2_reset();
+    motors_known = 0;
+
+    while (fgets(line, sizeof(line), file) != NULL) {
+        if (line[0] == '#') {
+            continue;
+        }
+        /* Level,Index,m:s.ms.us,Dur,Len,Err,Record,Data */
+        char * fields[8];
+        int field;
+        char * cursor = line;
+        for (field = 0; field < 8 && cursor != NULL; ++field) {
+            fields[field] = cursor;
+            cursor = strchr(cursor, ',');
+            if (cursor != NULL) {
+                *cursor++ = '\0';
+            }
+        }
+        if (field < 8) {
+            continue;
+        }
+        if (!strcmp(fields[6], "   MOSI")) {
+            index = strtoul(fields[1], NULL, 10);
+            mosi_count = parse_bytes(fields[7], mosi);
+        } else if (!strcmp(fields[6], "   MISO")) {
+            int miso_count = parse_bytes(fields[7], miso);
+            if (miso_count == 0 || miso_count != mosi_count) {
+                continue; // timeouts
+            }
+            if (mosi[0] != PS2_ADDRESS) {
+                continue; // not for the controller, or noise on the bus
+            }
+            ++*transactions;
+            uint8_t response[MAX_BYTES];
+            if (transaction(mosi, miso, response, miso_count) < 0) {
+                ++mismatches;
+                if (verbose || mismatches <= MAX_REPORTED) {
+                    printf("%s: transaction %lu differs\n", path, index);
+                    print_bytes("mosi    ", mosi, mosi_count);
+                    print_bytes("expected", miso, miso_count);
+                    print_bytes("response", response, miso_count);
+                }
+            }
+        }
+    }
+
+    fclose(file);
+    return mismatches;
+}
+
+static void usage(const char * program) {
+    fprintf(stderr, "usage: %s [-v] [-n iterations] capture.csv...\n", program);
+    exit(EXIT_USAGE);
+}
+
+int main(int argc, char * argv[]) {
+    int status = EXIT_PASS;
+    int i;
+
+    for (i = 1; i < argc && argv[i][0] == '-'; ++i) {
+        if (!strcmp(argv[i], "-v")) {
+            verbose = 1;
+        } else if (!strcmp(argv[i], "-n") && i + 1 < argc) {
+            iterations = atoi(argv[++i]);
+        } else {
+            usage(argv[0]);
+        }
+    }
+    if (i == argc || iterations < 1) {
+        usage(argv[0]);
+    }
+
+    for (; i < argc; ++i) {
+        unsigned int transactions = 0;
+        int mismatches = 0;
+        int iteration;
+        for (iteration = 0; iteration < iterations && mismatches == 0; ++iteration) {
+            mismatches = replay(argv[i], &transactions);
+        }
+        if (mismatches < 0) {
+            return EXIT_USAGE;
+        }
+        printf("%s: %s (%u transactions, %d mismatches)\n", argv[i], mismatches ? "FAIL" : "PASS", transactions,
+                mismatches);
+        if (mismatches) {
+            status = EXIT_FAIL;
+        }
+    }
+
+    printf("%-32s %10s %10s %10s %10s\n", "function", "calls", "min ns", "avg ns", "max ns");
+    timing_print("ps2_next", &next_timing);
+    timing_print("ps2_update", &update_timing);
+
+    return status;
+}
@@ -0,0 +1,2157 @@
+/*
+ Copyright (c) 2019 Mathieu Laurendeau <mat.lau@laposte.net>
+ License: GPLv3
+ */
+
+/*
+ * Host simulation of an adapter: the firmware (emu.c + adapter_common.c + Descriptors.c) runs on the host
+ * against stand-in AVR/LUFA headers, and this file simulates the hardware around it:
+ * - the USART1 wire, paced at the configured baudrate, with the 2-byte receive FIFO of the ATmega32U4,
+ * - Timer/Counter1,
+ * - the USB device controller, with a host that sends a start of frame every millisecond, and polls the interrupt
+ *   endpoints at their descriptor interval, SIM_TOKEN_DELAY_NS after the start of frame,
+ * - the SPI slave, with a console that asserts attention (PB0) and exchanges the scripted bytes, one every
+ *   SIM_SPI_BYTE_NS, once the firmware handled the previous one,
+ * - the interrupt controller: a periodic signal plays the role of the hardware, and runs pending vectors
+ *   when the global interrupt flag is set,
+ * - a scripted host (GIMX software + console), see scripts/,
+ * - the EEPROM: the EEMEM variables of the firmware, erased at start. A watchdog reset executes the simulation
+ *   again, with the EEPROM and the script position, as the firmware restarts with a clean state.
+ *
+ * The time base is the host monotonic clock, minus the time the firmware can't see: the time spent in the
+ * simulated hardware, and the time the process is descheduled or waits for the next tick. Firmware functions are instrumented
+ * (-finstrument-functions) to measure the time spent in the hot paths, excluding nested interrupts. They also count
+ * their hardware accesses (registers and LUFA endpoint calls): unlike the times, the counts of a given path don't
+ * depend on the host, so that the maximum per call compares between runs and commits.
+ */
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+#include <time.h>
+#include <errno.h>
+#include <ctype.h>
+#include <unistd.h>
+
+#include <LUFA/Drivers/USB/USB.h>
+#include <LUFA/Drivers/Peripheral/Serial.h>
+#include <util/crc16.h>
+
+#include "../adapter_protocol.h"
+
+#define SIM_TICK_NS 25000
+/*
+ * Longest time step of the simulated hardware: the firmware runs far below this between two register
+ * accesses, so longer gaps are host scheduling, and are not seen by the firmware.
+ */
+#define SIM_MAX_STEP_NS 4000
+
+#define UART_RX_FIFO_SIZE 2
+#define UART_LOG_SIZE     (1 << 20)
+#define UART_QUEUE_SIZE   (1 << 16)
+
+#define SIM_ENDPOINTS      7
+#define SIM_ENDPOINT_SIZE  64
+#define SIM_CONTROL_SIZE   1024
+#define SIM_IN_QUEUE_SIZE  256
+#define SIM_SENT_REPORTS   16
+#define SIM_TOKEN_DELAY_NS 100000
+
+#define SIM_SPI_SIZE       64
+#define SIM_SPI_BYTE_NS    16000 // 500KHz clock
+#define SIM_ATTENTION_PIN  0
+
+#define DEFAULT_HOST_BAUDRATE 500000
+#define DEFAULT_TIMEOUT_MS    100
+#define CONTROL_TIMEOUT_MS    2000
+#define ATTACH_TIMEOUT_MS     1000
+#define STREAM_TIMEOUT_MS     100
+
+#define EXIT_PASS     0
+#define EXIT_FAIL     1
+#define EXIT_USAGE    2
+#define EXIT_WATCHDOG 3
+
+/*
+ * Registers.
+ */
+
+volatile uint8_t MCUSR;
+volatile uint8_t PORTB, DDRB, PINB;
+volatile uint8_t PORTD, DDRD, PIND;
+volatile uint8_t UCSR1B;
+volatile uint8_t UCSR1C;
+volatile uint16_t UBRR1;
+volatile uint8_t TCCR1A;
+volatile uint8_t TCCR1B;
+volatile uint8_t SPCR;
+volatile uint8_t SPSR;
+volatile uint8_t PCICR;
+volatile uint8_t PCMSK0;
+
+USB_Request_Header_t USB_ControlRequest;
+volatile uint8_t USB_DeviceState;
+
+/*
+ * Firmware symbols: vectors and hot paths. Optional ones are weak.
+ */
+
+int emu_main(void);
+
+extern void USART1_RX_vect(void) __attribute__((weak));
+extern void USART1_UDRE_vect(void) __attribute__((weak));
+extern void SPI_STC_vect(void) __attribute__((weak));
+extern void PCINT0_vect(void) __attribute__((weak));
+extern void EVENT_USB_Device_ControlRequest(void) __attribute__((weak));
+extern void SendNextReport(void) __attribute__((weak));
+extern void ReceiveNextReport(void) __attribute__((weak));
+extern void EVENT_USB_Device_StartOfFrame(void) __attribute__((weak));
+extern void USB_COM_vect(void) __attribute__((weak));
+
+/*
+ * Simulation state.
+ */
+
+static uint64_t origin;
+static volatile uint64_t hidden_ns;
+static volatile uint64_t last_raw_ns;
+static volatile uint32_t clock_seq;
+static int verbose;
+static const char * script_path;
+static const char * json_path;
+static const char * firmware;
+static const char * eeprom_path;
+static int resume_pc;
+
+extern uint8_t __start_sim_eeprom[] __attribute__((weak));
+extern uint8_t __stop_sim_eeprom[] __attribute__((weak));
+
+static volatile sig_atomic_t busy;
+static volatile sig_atomic_t in_isr;
+static volatile sig_atomic_t irq_enabled;
+
+static struct {
+    /* host to adapter */
+    uint32_t baudrate;
+    uint8_t queue[UART_QUEUE_SIZE];
+    uint32_t queue_head;
+    uint32_t queue_tail;
+    uint64_t next;
+    uint8_t fifo[UART_RX_FIFO_SIZE];
+    uint8_t fifo_count;
+    uint8_t last_rx;
+    uint8_t dor;
+    uint8_t fe;
+    uint8_t u2x;
+    /* adapter to host */
+    uint8_t hold;
+    uint8_t hold_full;
+    uint64_t hold_at;
+    uint8_t shift;
+    uint8_t shift_busy;
+    uint64_t shift_done;
+    uint8_t txc;
+    uint8_t log[UART_LOG_SIZE];
+    uint32_t log_len;
+    /* data register accessor */
+    volatile uint16_t cell;
+    uint16_t cell_preload;
+    uint8_t cell_pending;
+    /* statistics */
+    uint64_t rx_bytes;
+    uint64_t tx_bytes;
+    uint64_t overruns;
+    uint64_t frame_errors;
+} uart = { .baudrate = DEFAULT_HOST_BAUDRATE };
+
+static struct {
+    volatile uint16_t counter;
+    uint64_t last_ps;
+} timer1;
+
+/*
+ * SPI slave and console. As on the hardware, the data register sends the received byte again if the firmware
+ * does not load a new one.
+ */
+static struct {
+    volatile uint16_t cell;
+    uint16_t cell_preload;
+    uint8_t cell_pending;
+    uint8_t tx;
+    uint8_t rx;
+    uint8_t stc_pending;
+    uint8_t pcint_pending;
+    /* console */
+    uint8_t active;
+    uint8_t done;
+    uint16_t pos;
+    uint16_t len;
+    uint8_t mosi[SIM_SPI_SIZE];
+    uint8_t miso[SIM_SPI_SIZE];
+    uint64_t next;
+    /* statistics */
+    uint64_t transactions;
+} spi;
+
+struct bank {
+    uint8_t ready;
+    uint16_t len;
+    uint8_t data[SIM_ENDPOINT_SIZE];
+};
+
+static struct {
+    uint8_t configured;
+    uint8_t address;
+    uint8_t type;
+    uint16_t size;
+    uint8_t banks;
+    uint8_t interval;
+    struct bank bank[2];
+    uint8_t fw;
+    uint8_t host;
+    uint16_t pos;
+    uint8_t nakin;
+    uint8_t ienx;
+} ep[SIM_ENDPOINTS];
+
+static uint8_t current_ep;
+
+/*
+ * UCSR1A accessor: one cell for the main loop and one for the interrupts, resolved like UDR1.
+ */
+static struct {
+    volatile uint16_t cell;
+    uint16_t preload;
+    uint8_t pending;
+} ucsr1a[2];
+
+/*
+ * UEINTX accessor: one cell for the main loop and one for the interrupts, resolved like UDR1.
+ */
+static struct {
+    volatile uint8_t cell;
+    uint8_t preload;
+    uint8_t pending;
+    uint8_t ep;
+} ueintx[2];
+
+enum {
+    CONTROL_IDLE,
+    CONTROL_PENDING,
+    CONTROL_ACTIVE,
+    CONTROL_DONE,
+};
+
+static struct {
+    uint8_t state;
+    USB_Request_Header_t setup;
+    uint8_t cleared;
+    uint8_t stalled;
+    uint8_t out[SIM_CONTROL_SIZE];
+    uint16_t out_len;
+    uint8_t in[SIM_CONTROL_SIZE];
+    uint16_t in_len;
+} ctrl;
+
+static struct {
+    uint8_t attached;
+    uint64_t frame;
+    uint64_t next_frame;
+    uint64_t tokens_at;
+    uint8_t sof_enabled;
+    uint8_t sof_pending;
+    struct {
+        uint8_t ep;
+        uint16_t len;
+        uint8_t data[SIM_ENDPOINT_SIZE];
+        uint64_t at;
+    } in[SIM_IN_QUEUE_SIZE];
+    uint32_t in_head;
+    uint32_t in_tail;
+    uint8_t out[SIM_ENDPOINT_SIZE];
+    uint16_t out_len;
+    uint8_t out_pending;
+    /* statistics */
+    uint64_t in_reports;
+    uint64_t out_reports;
+    uint64_t control_transfers;
+} usb;
+
+/*
+ * IN reports sent by the script, to measure the age of the reports read by the USB host: the time from the end of
+ * their transmission on the UART wire to the IN transfer.
+ */
+static struct {
+    struct {
+        uint32_t end;
+        uint64_t done;
+        uint8_t len;
+        uint8_t data[SIM_ENDPOINT_SIZE];
+    } report[SIM_SENT_REPORTS];
+    uint32_t head;
+    uint32_t tail;
+} sent;
+
+static struct {
+    uint64_t samples;
+    uint64_t min;
+    uint64_t max;
+    uint64_t sum;
+} age = { .min = UINT64_MAX };
+
+/*
+ * Longest time with the interrupts disabled, by the firmware or while running a vector.
+ * The time from reset to the first sei() is not counted.
+ */
+static struct {
+    int active;
+    uint64_t start;
+    uint64_t max;
+} irq_off;
+
+/*
+ * Profiling of the firmware hot paths.
+ */
+
+static struct {
+    const char * name;
+    void * fn;
+    uint64_t calls;
+    uint64_t min;
+    uint64_t max;
+    uint64_t sum;
+    uint64_t io_min;
+    uint64_t io_max;
+    uint64_t io_sum;
+} tracked[] = {
+    { "USART1_RX_vect" },
+    { "USART1_UDRE_vect" },
+    { "SendNextReport" },
+    { "ReceiveNextReport" },
+    { "EVENT_USB_Device_ControlRequest" },
+    { "EVENT_USB_Device_StartOfFrame" },
+    { "SPI_STC_vect" },
+    { "PCINT0_vect" },
+    { "USB_COM_vect" },
+};
+
+#define TRACKED_COUNT (sizeof(tracked) / sizeof(*tracked))
+
+static struct frame {
+    int index;
+    uint64_t start;
+    uint64_t child;
+    uint64_t io;
+} frames[64];
+
+static volatile int depth;
+
+static uint64_t raw_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000ULL + ts.tv_nsec - origin;
+}
+
+/*
+ * Time as seen by the firmware: at most SIM_MAX_STEP_NS after the last hardware update.
+ * A tick may update the clock while it is read outside a busy section, the sequence number detects it.
+ */
+static uint64_t now_ns(void) {
+    uint32_t seq;
+    uint64_t hidden, last, raw;
+    do {
+        seq = clock_seq;
+        __asm__ __volatile__("" ::: "memory");
+        hidden = hidden_ns;
+        last = last_raw_ns;
+        raw = raw_ns();
+        __asm__ __volatile__("" ::: "memory");
+    } while (seq != clock_seq);
+    if (last && raw - last > SIM_MAX_STEP_NS) {
+        raw = last + SIM_MAX_STEP_NS;
+    }
+    return raw - hidden;
+}
+
+static int tracked_index(void * fn) {
+    unsigned int i;
+    for (i = 0; i < TRACKED_COUNT; ++i) {
+        if (tracked[i].fn == fn) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+void __cyg_profile_func_enter(void * fn, void * site) __attribute__((no_instrument_function));
+void __cyg_profile_func_exit(void * fn, void * site) __attribute__((no_instrument_function));
+
+void __cyg_profile_func_enter(void * fn, void * site) {
+    (void) site;
+    int index = tracked_index(fn);
+    if (index < 0 || depth >= (int) (sizeof(frames) / sizeof(*frames))) {
+        return;
+    }
+    // reserve the frame first, a nested interrupt will use the next one
+    int d = depth++;
+    __asm__ __volatile__("" ::: "memory");
+    frames[d] = (struct frame) { .index = index, .start = now_ns() };
+}
+
+void __cyg_profile_func_exit(void * fn, void * site) {
+    (void) site;
+    int index = tracked_index(fn);
+    if (index < 0 || depth == 0 || frames[depth - 1].index != index) {
+        return;
+    }
+    int d = depth - 1;
+    struct frame * f = frames + d;
+    uint64_t now = now_ns();
+    uint64_t elapsed = now > f->start ? now - f->start : 0;
+    uint64_t self = elapsed - f->child;
+    if (d > 0) {
+        frames[d - 1].child += elapsed;
+    }
+    __asm__ __volatile__("" ::: "memory");
+    depth = d;
+    if (self > elapsed) {
+        self = 0;
+    }
+    tracked[index].calls++;
+    tracked[index].sum += self;
+    if (self < tracked[index].min || tracked[index].calls == 1) {
+        tracked[index].min = self;
+    }
+    if (self > tracked[index].max) {
+        tracked[index].max = self;
+    }
+    tracked[index].io_sum += f->io;
+    if (f->io < tracked[index].io_min || tracked[index].calls == 1) {
+        tracked[index].io_min = f->io;
+    }
+    if (f->io > tracked[index].io_max) {
+        tracked[index].io_max = f->io;
+    }
+}
+
+/*
+ * Scripted host, one command per line, bytes in hex, ?? matches any byte:
+ * send <bytes>                  send a packet to the adapter (framed with "framing on")
+ * raw <bytes>                   send bytes as is
+ * expect <bytes>                wait for a packet from the adapter (framed with "framing on")
+ * framing on|off                protocol version 9 framing
+ * delay <ms>, timeout <ms>      wait, set the timeout of the expect commands
+ * baudrate <bps>                host baudrate
+ * repeat <n> ... end            loop
+ * enumerate                     wait for the adapter to attach, and configure it
+ * control <bmRequestType> <bRequest> <wValue> <wIndex> <wLength> [data]
+ * expect-control <bytes>|stall  wait for the end of the control transfer
+ * out <bytes>                   send an OUT report
+ * expect-in <bytes>             wait for an IN report
+ * spi <bytes>                   run a console transaction on the SPI bus
+ * expect-spi <bytes>            check the bytes sent by the adapter in the last transaction
+ */
+
+enum {
+    CMD_SEND,
+    CMD_EXPECT,
+    CMD_DELAY,
+    CMD_BAUDRATE,
+    CMD_TIMEOUT,
+    CMD_REPEAT,
+    CMD_END,
+    CMD_ENUMERATE,
+    CMD_CONTROL,
+    CMD_EXPECT_CONTROL,
+    CMD_OUT,
+    CMD_EXPECT_IN,
+    CMD_FRAMING,
+    CMD_RAW,
+    CMD_SPI,
+    CMD_EXPECT_SPI,
+};
+
+static const char * command_names[] = {
+    [CMD_SEND] = "send",
+    [CMD_EXPECT] = "expect",
+    [CMD_DELAY] = "delay",
+    [CMD_BAUDRATE] = "baudrate",
+    [CMD_TIMEOUT] = "timeout",
+    [CMD_REPEAT] = "repeat",
+    [CMD_END] = "end",
+    [CMD_ENUMERATE] = "enumerate",
+    [CMD_CONTROL] = "control",
+    [CMD_EXPECT_CONTROL] = "expect-control",
+    [CMD_OUT] = "out",
+    [CMD_EXPECT_IN] = "expect-in",
+    [CMD_FRAMING] = "framing",
+    [CMD_RAW] = "raw",
+    [CMD_SPI] = "spi",
+    [CMD_EXPECT_SPI] = "expect-spi",
+};
+
+#define WILDCARD 0x100
+#define STALL    0x200
+
+struct command {
+    int type;
+    int line;
+    uint32_t value;
+    uint16_t len;
+    uint16_t data[SIM_CONTROL_SIZE];
+};
+
+static struct command * commands;
+static int command_count;
+
+static struct {
+    int pc;
+    uint8_t started;
+    uint64_t start;
+    uint32_t timeout_ms;
+    uint32_t cursor;
+    int step;
+    struct {
+        int pc;
+        uint32_t count;
+    } loops[8];
+    int loop_depth;
+    /* protocol version 9 framing */
+    uint8_t framing;
+    uint8_t tx_sequence;
+    uint8_t rx_sequence;
+} script = { .timeout_ms = DEFAULT_TIMEOUT_MS };
+
+static void finish(int status) __attribute__((noreturn));
+
+static void print_bytes(const char * prefix, const uint8_t * data, uint32_t len) {
+    uint32_t i;
+    printf("%10.3f ms %s", now_ns() / 1e6, prefix);
+    for (i = 0; i < len; ++i) {
+        printf(" %02x", data[i]);
+    }
+    printf("\n");
+}
+
+static void fail(const struct command * cmd, const char * reason) {
+    printf("%s:%d: %s: %s\n", script_path, cmd->line, command_names[cmd->type], reason);
+    finish(EXIT_FAIL);
+}
+
+static int compare(const struct command * cmd, const uint8_t * data, uint32_t len) {
+    uint32_t i;
+    if (len != cmd->len) {
+        return -1;
+    }
+    for (i = 0; i < len; ++i) {
+        if (cmd->data[i] != WILDCARD && cmd->data[i] != data[i]) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+static void expect_failed(const struct command * cmd, const char * what, const uint8_t * data, uint32_t len) {
+    uint32_t i;
+    printf("%s:%d: %s: mismatch\n  expected:", script_path, cmd->line, command_names[cmd->type]);
+    for (i = 0; i < cmd->len; ++i) {
+        if (cmd->data[i] == WILDCARD) {
+            printf(" ??");
+        } else if (cmd->data[i] == STALL) {
+            printf(" stall");
+        } else {
+            printf(" %02x", cmd->data[i]);
+        }
+    }
+    printf("\n  %8s:", what);
+    for (i = 0; i < len; ++i) {
+        printf(" %02x", data[i]);
+    }
+    printf("\n");
+    finish(EXIT_FAIL);
+}
+
+static void host_send(const uint8_t * data, uint32_t len) {
+    uint32_t i;
+    for (i = 0; i < len; ++i) {
+        uart.queue[uart.queue_tail++ % UART_QUEUE_SIZE] = data[i];
+    }
+}
+
+static int control_post(uint8_t bmRequestType, uint8_t bRequest, uint16_t wValue, uint16_t wIndex, uint16_t wLength,
+        const uint8_t * data, uint16_t len) {
+    if (ctrl.state == CONTROL_PENDING || ctrl.state == CONTROL_ACTIVE) {
+        return -1;
+    }
+    ctrl.setup = (USB_Request_Header_t) {
+        .bmRequestType = bmRequestType,
+        .bRequest = bRequest,
+        .wValue = wValue,
+        .wIndex = wIndex,
+        .wLength = wLength
+    };
+    memcpy(ctrl.out, data, len);
+    ctrl.out_len = len;
+    ctrl.in_len = 0;
+    ctrl.state = CONTROL_PENDING;
+    return 0;
+}
+
+/*
+ * Parse the endpoint descriptors to get the polling intervals.
+ */
+static void parse_configuration(const uint8_t * data, uint16_t len) {
+    uint16_t i = 0;
+    while (i + 2 <= len && data[i] >= 2) {
+        if (data[i + 1] == DTYPE_Endpoint && i + sizeof(USB_Descriptor_Endpoint_t) <= len) {
+            const USB_Descriptor_Endpoint_t * desc = (const USB_Descriptor_Endpoint_t *) (data + i);
+            uint8_t n = desc->EndpointAddress & ENDPOINT_EPNUM_MASK;
+            if (n < SIM_ENDPOINTS && ep[n].interval == 0) {
+                ep[n].interval = desc->PollingIntervalMS ? desc->PollingIntervalMS : 1;
+            }
+        }
+        i += data[i];
+    }
+}
+
+/*
+ * Returns 1 when the command is complete, 0 when it has to wait.
+ */
+static int script_step(struct command * cmd, uint64_t now) {
+    uint64_t elapsed_ms = (now - script.start) / 1000000;
+    switch (cmd->type) {
+    case CMD_SEND:
+    case CMD_RAW: {
+        uint8_t data[SIM_CONTROL_SIZE + FRAME_OVERHEAD];
+        uint16_t i, len = 0;
+        int framed = (cmd->type == CMD_SEND && script.framing);
+        if (framed) {
+            data[len++] = BYTE_FRAME_START;
+            data[len++] = script.tx_sequence++;
+        }
+        for (i = 0; i < cmd->len; ++i) {
+            data[len++] = cmd->data[i];
+        }
+        if (framed) {
+            uint16_t crc = FRAME_CRC_INIT;
+            for (i = 1; i < len; ++i) {
+                crc = _crc_ccitt_update(crc, data[i]);
+            }
+            data[len++] = crc & 0xff;
+            data[len++] = crc >> 8;
+        }
+        host_send(data, len);
+        if (cmd->type == CMD_SEND && cmd->len >= 2 && cmd->data[0] == BYTE_IN_REPORT
+                && cmd->len - 2 <= SIM_ENDPOINT_SIZE) {
+            uint32_t index = sent.tail++ % SIM_SENT_REPORTS;
+            if (sent.tail - sent.head > SIM_SENT_REPORTS) {
+                sent.head = sent.tail - SIM_SENT_REPORTS;
+            }
+            sent.report[index].end = uart.queue_tail;
+            sent.report[index].done = 0;
+            sent.report[index].len = cmd->len - 2;
+            for (i = 2; i < cmd->len; ++i) {
+                sent.report[index].data[i - 2] = cmd->data[i];
+            }
+        }
+        if (verbose) {
+            print_bytes("uart>", data, len);
+        }
+        return 1;
+    }
+    case CMD_EXPECT: {
+        uint32_t len = cmd->len + (script.framing ? FRAME_OVERHEAD : 0);
+        if (uart.log_len - script.cursor >= len) {
+            const uint8_t * data = uart.log + script.cursor;
+            if (script.framing) {
+                uint16_t crc = FRAME_CRC_INIT;
+                uint32_t i;
+                for (i = 1; i < len - 2; ++i) {
+                    crc = _crc_ccitt_update(crc, data[i]);
+                }
+                if (data[0] != BYTE_FRAME_START || data[1] != script.rx_sequence
+                        || data[len - 2] != (crc & 0xff) || data[len - 1] != (crc >> 8)) {
+                    expect_failed(cmd, "bad frame", data, len);
+                }
+                ++script.rx_sequence;
+                if (compare(cmd, data + 2, cmd->len) < 0) {
+                    expect_failed(cmd, "received", data, len);
+                }
+            } else if (compare(cmd, data, len) < 0) {
+                expect_failed(cmd, "received", data, len);
+            }
+            if (verbose) {
+                print_bytes("uart<", data, len);
+            }
+            script.cursor += len;
+            return 1;
+        }
+        if (elapsed_ms >= script.timeout_ms) {
+            expect_failed(cmd, "received", uart.log + script.cursor, uart.log_len - script.cursor);
+        }
+        return 0;
+    }
+    case CMD_FRAMING:
+        script.framing = cmd->value;
+        return 1;
+    case CMD_DELAY:
+        return elapsed_ms >= cmd->value;
+    case CMD_BAUDRATE:
+        uart.baudrate = cmd->value;
+        return 1;
+    case CMD_TIMEOUT:
+        script.timeout_ms = cmd->value;
+        return 1;
+    case CMD_REPEAT:
+        if (script.loop_depth == sizeof(script.loops) / sizeof(*script.loops)) {
+            fail(cmd, "too many nested loops");
+        }
+        script.loops[script.loop_depth].pc = script.pc;
+        script.loops[script.loop_depth].count = cmd->value;
+        ++script.loop_depth;
+        return 1;
+    case CMD_END:
+        if (script.loop_depth == 0) {
+            fail(cmd, "no matching repeat");
+        }
+        if (--script.loops[script.loop_depth - 1].count > 0) {
+            script.pc = script.loops[script.loop_depth - 1].pc;
+        } else {
+            --script.loop_depth;
+        }
+        return 1;
+    case CMD_ENUMERATE:
+        /*
+         * Same sequence as a console: device descriptor, address, configuration descriptor, configuration.
+         */
+        switch (script.step) {
+        case 0:
+            if (!usb.attached) {
+                if (elapsed_ms >= ATTACH_TIMEOUT_MS) {
+                    fail(cmd, "device not attached");
+                }
+                return 0;
+            }
+            control_post(0x80, REQ_GetDescriptor, DTYPE_Device << 8, 0x0000, 0x0040, NULL, 0);
+            ++script.step;
+            return 0;
+        case 1:
+        case 2:
+        case 3:
+        case 4:
+            if (ctrl.state != CONTROL_DONE) {
+                if (elapsed_ms >= CONTROL_TIMEOUT_MS) {
+                    fail(cmd, "control transfer timeout");
+                }
+                return 0;
+            }
+            if (ctrl.stalled) {
+                fail(cmd, "control transfer stalled");
+            }
+            ctrl.state = CONTROL_IDLE;
+            switch (script.step++) {
+            case 1:
+                control_post(0x00, REQ_SetAddress, 0x0001, 0x0000, 0x0000, NULL, 0);
+                return 0;
+            case 2:
+                control_post(0x80, REQ_GetDescriptor, DTYPE_Configuration << 8, 0x0000, SIM_CONTROL_SIZE, NULL, 0);
+                return 0;
+            case 3:
+                parse_configuration(ctrl.in, ctrl.in_len);
+                control_post(0x00, REQ_SetConfiguration, 0x0001, 0x0000, 0x0000, NULL, 0);
+                return 0;
+            }
+            return 1;
+        }
+        return 1;
+    case CMD_CONTROL: {
+        uint8_t data[SIM_CONTROL_SIZE];
+        uint16_t i;
+        for (i = 5; i < cmd->len; ++i) {
+            data[i - 5] = cmd->data[i];
+        }
+        if (control_post(cmd->data[0], cmd->data[1], cmd->data[2], cmd->data[3], cmd->data[4], data, cmd->len - 5) < 0) {
+            fail(cmd, "control transfer already in progress");
+        }
+        return 1;
+    }
+    case CMD_EXPECT_CONTROL:
+        if (ctrl.state != CONTROL_DONE) {
+            if (elapsed_ms >= CONTROL_TIMEOUT_MS) {
+                fail(cmd, "control transfer timeout");
+            }
+            return 0;
+        }
+        ctrl.state = CONTROL_IDLE;
+        if (verbose) {
+            if (ctrl.stalled) {
+                printf("%10.3f ms control stall\n", now / 1e6);
+            } else {
+                print_bytes("control<", ctrl.in, ctrl.in_len);
+            }
+        }
+        if (cmd->len == 1 && cmd->data[0] == STALL) {
+            if (!ctrl.stalled) {
+                expect_failed(cmd, "received", ctrl.in, ctrl.in_len);
+            }
+        } else if (ctrl.stalled || compare(cmd, ctrl.in, ctrl.in_len) < 0) {
+            expect_failed(cmd, ctrl.stalled ? "stalled" : "received", ctrl.in, ctrl.in_len);
+        }
+        return 1;
+    case CMD_OUT:
+        if (script.step == 0) {
+            uint16_t i;
+            for (i = 0; i < cmd->len; ++i) {
+                usb.out[i] = cmd->data[i];
+            }
+            usb.out_len = cmd->len;
+            usb.out_pending = 1;
+            ++script.step;
+        }
+        if (usb.out_pending) {
+            if (elapsed_ms >= script.timeout_ms) {
+                fail(cmd, "OUT endpoint not ready");
+            }
+            return 0;
+        }
+        return 1;
+    case CMD_SPI:
+        if (script.step == 0) {
+            uint16_t i;
+            if (cmd->len > SIM_SPI_SIZE) {
+                fail(cmd, "transaction too long");
+            }
+            for (i = 0; i < cmd->len; ++i) {
+                spi.mosi[i] = cmd->data[i];
+            }
+            spi.len = cmd->len;
+            spi.pos = 0;
+            spi.done = 0;
+            spi.active = 1;
+            spi.next = now + SIM_SPI_BYTE_NS;
+            PINB &= ~(1 << SIM_ATTENTION_PIN);
+            spi.pcint_pending = 1;
+            ++script.step;
+        }
+        if (!spi.done) {
+            if (elapsed_ms >= script.timeout_ms) {
+                fail(cmd, "transaction timeout");
+            }
+            return 0;
+        }
+        if (verbose) {
+            print_bytes("spi>", spi.mosi, spi.len);
+            print_bytes("spi<", spi.miso, spi.len);
+        }
+        return 1;
+    case CMD_EXPECT_SPI:
+        if (compare(cmd, spi.miso, spi.len) < 0) {
+            expect_failed(cmd, "received", spi.miso, spi.len);
+        }
+        return 1;
+    case CMD_EXPECT_IN:
+        if (usb.in_head != usb.in_tail) {
+            uint32_t index = usb.in_head++ % SIM_IN_QUEUE_SIZE;
+            if (compare(cmd, usb.in[index].data, usb.in[index].len) < 0) {
+                expect_failed(cmd, "received", usb.in[index].data, usb.in[index].len);
+            }
+            return 1;
+        }
+        if (elapsed_ms >= script.timeout_ms) {
+            expect_failed(cmd, "received", NULL, 0);
+        }
+        return 0;
+    }
+    return 1;
+}
+
+static void script_advance(uint64_t now) {
+    while (script.pc < command_count) {
+        struct command * cmd = commands + script.pc;
+        if (!script.started) {
+            script.started = 1;
+            script.start = now;
+            script.step = 0;
+        }
+        if (!script_step(cmd, now)) {
+            return;
+        }
+        script.started = 0;
+        ++script.pc;
+    }
+    finish(EXIT_PASS);
+}
+
+static int parse_hex(const char * token, uint16_t * value) {
+    char * end;
+    if (!strcmp(token, "??")) {
+        *value = WILDCARD;
+        return 0;
+    }
+    if (!strcmp(token, "stall")) {
+        *value = STALL;
+        return 0;
+    }
+    unsigned long v = strtoul(token, &end, 16);
+    if (*end != '\0' || v > 0xffff) {
+        return -1;
+    }
+    *value = v;
+    return 0;
+}
+
+static int load_script(const char * path) {
+    FILE * file = fopen(path, "r");
+    if (file == NULL) {
+        perror(path);
+        return -1;
+    }
+    char line[4096];
+    int line_number = 0;
+    while (fgets(line, sizeof(line), file) != NULL) {
+        ++line_number;
+        char * comment = strchr(line, '#');
+        if (comment != NULL) {
+            *comment = '\0';
+        }
+        char * token = strtok(line, " \t\r\n");
+        if (token == NULL) {
+            continue;
+        }
+        struct command cmd = { .line = line_number, .type = -1 };
+        unsigned int i;
+        for (i = 0; i < sizeof(command_names) / sizeof(*command_names); ++i) {
+            if (!strcmp(token, command_names[i])) {
+                cmd.type = i;
+            }
+        }
+        if (cmd.type < 0) {
+            fprintf(stderr, "%s:%d: unknown command: %s\n", path, line_number, token);
+            fclose(file);
+            return -1;
+        }
+        while ((token = strtok(NULL, " \t\r\n")) != NULL) {
+            switch (cmd.type) {
+            case CMD_DELAY:
+            case CMD_BAUDRATE:
+            case CMD_TIMEOUT:
+            case CMD_REPEAT:
+                cmd.value = strtoul(token, NULL, 10);
+                break;
+            case CMD_FRAMING:
+                cmd.value = !strcmp(token, "on");
+                break;
+            default:
+                if (cmd.len == SIM_CONTROL_SIZE || parse_hex(token, cmd.data + cmd.len) < 0) {
+                    fprintf(stderr, "%s:%d: invalid value: %s\n", path, line_number, token);
+                    fclose(file);
+                    return -1;
+                }
+                ++cmd.len;
+                break;
+            }
+        }
+        if (cmd.type == CMD_CONTROL && cmd.len < 5) {
+            fprintf(stderr, "%s:%d: usage: control bmRequestType bRequest wValue wIndex wLength [data...]\n", path, line_number);
+            fclose(file);
+            return -1;
+        }
+        commands = realloc(commands, (command_count + 1) * sizeof(*commands));
+        commands[command_count++] = cmd;
+    }
+    fclose(file);
+    return 0;
+}
+
+/*
+ * UART wire.
+ */
+
+static uint32_t adapter_baudrate(void) {
+    return F_CPU / ((uart.u2x ? 8 : 16) * ((uint32_t) UBRR1 + 1));
+}
+
+/*
+ * Baudrates more than 2% apart garble the bytes.
+ */
+static int baudrate_mismatch(void) {
+    uint32_t adapter = adapter_baudrate();
+    uint32_t diff = adapter > uart.baudrate ? adapter - uart.baudrate : uart.baudrate - adapter;
+    return diff * 50 > uart.baudrate;
+}
+
+static uint64_t byte_time(uint32_t baudrate) {
+    return 10ULL * 1000000000ULL / baudrate;
+}
+
+static void uart_receive(uint8_t byte) {
+    if (!(UCSR1B & (1 << RXEN1))) {
+        return;
+    }
+    if (baudrate_mismatch()) {
+        byte = ~byte;
+        uart.fe = 1;
+        ++uart.frame_errors;
+    }
+    if (uart.fifo_count == UART_RX_FIFO_SIZE) {
+        uart.dor = 1;
+        ++uart.overruns;
+        return;
+    }
+    uart.fifo[uart.fifo_count++] = byte;
+    ++uart.rx_bytes;
+}
+
+static void uart_advance(uint64_t now) {
+    uint64_t duration = byte_time(uart.baudrate);
+    // host to adapter
+    if (uart.next == 0 && uart.queue_head != uart.queue_tail) {
+        uart.next = now + duration;
+    }
+    while (uart.next != 0 && uart.next <= now) {
+        uart_receive(uart.queue[uart.queue_head++ % UART_QUEUE_SIZE]);
+        while (sent.head != sent.tail && sent.report[sent.head % SIM_SENT_REPORTS].end == uart.queue_head) {
+            sent.report[sent.head++ % SIM_SENT_REPORTS].done = uart.next;
+        }
+        if (uart.queue_head != uart.queue_tail) {
+            uart.next += duration;
+        } else {
+            uart.next = 0;
+        }
+    }
+    // adapter to host
+    duration = byte_time(adapter_baudrate());
+    while (1) {
+        if (uart.shift_busy && uart.shift_done <= now) {
+            uint8_t byte = uart.shift;
+            if (baudrate_mismatch()) {
+                byte = ~byte;
+            }
+            if (uart.log_len < UART_LOG_SIZE) {
+                uart.log[uart.log_len++] = byte;
+            }
+            uart.shift_busy = 0;
+            if (!uart.hold_full || uart.hold_at > uart.shift_done) {
+                uart.txc = 1; // the data register was empty, TXC1 stays set until cleared
+            }
+            ++uart.tx_bytes;
+        }
+        if (!uart.shift_busy && uart.hold_full) {
+            uint64_t start = uart.hold_at > uart.shift_done ? uart.hold_at : uart.shift_done;
+            uart.shift = uart.hold;
+            uart.hold_full = 0;
+            uart.shift_busy = 1;
+            uart.shift_done = start + duration;
+            continue;
+        }
+        break;
+    }
+}
+
+static void uart_transmit(uint8_t byte) {
+    if (!(UCSR1B & (1 << TXEN1)) || uart.hold_full) {
+        // writing a non-empty data register is lost
+        return;
+    }
+    uart.hold = byte;
+    uart.hold_full = 1;
+    uart.hold_at = now_ns();
+}
+
+/*
+ * Resolve the previous access to UDR1: the accessor cannot tell reads from writes, so the cell is preloaded
+ * with a value that a byte write can't produce.
+ */
+static void udr1_resolve(void) {
+    if (!uart.cell_pending) {
+        return;
+    }
+    uart.cell_pending = 0;
+    if (uart.cell != uart.cell_preload) {
+        uart_transmit(uart.cell);
+    } else if (uart.fifo_count) {
+        uart.last_rx = uart.fifo[0];
+        memmove(uart.fifo, uart.fifo + 1, --uart.fifo_count);
+        uart.fe = 0;
+    }
+}
+
+/*
+ * Resolve the previous access to SPDR, as for UDR1: a write loads the byte to send.
+ */
+static void spdr_resolve(void) {
+    if (!spi.cell_pending) {
+        return;
+    }
+    spi.cell_pending = 0;
+    if (spi.cell != spi.cell_preload) {
+        spi.tx = spi.cell;
+    }
+}
+
+/*
+ * Resolve the previous access to UCSR1A in the current context: a write clears TXC1 if its bit is 1, and sets U2X1.
+ */
+static void ucsr1a_resolve(void) {
+    typeof(*ucsr1a) * access = ucsr1a + (in_isr ? 1 : 0);
+    if (!access->pending) {
+        return;
+    }
+    access->pending = 0;
+    if (access->cell != access->preload) {
+        if (access->cell & (1 << TXC1)) {
+            uart.txc = 0;
+        }
+        uart.u2x = (access->cell & (1 << U2X1)) ? 1 : 0;
+    }
+}
+
+/*
+ * Resolve the previous access to UEINTX in the current context: a write clearing NAKINI clears the flag.
+ */
+static void ueintx_resolve(void) {
+    typeof(*ueintx) * access = ueintx + (in_isr ? 1 : 0);
+    if (!access->pending) {
+        return;
+    }
+    access->pending = 0;
+    if (access->cell != access->preload && !(access->cell & (1 << NAKINI))) {
+        ep[access->ep].nakin = 0;
+    }
+}
+
+/*
+ * USB host.
+ */
+
+/*
+ * Age of the IN report, if it is the last one sent by the script with this content.
+ */
+static void age_sample(const struct bank * bank, uint64_t now) {
+    uint32_t j;
+    for (j = sent.head; j != 0 && sent.head - j < SIM_SENT_REPORTS; --j) {
+        const typeof(*sent.report) * report = sent.report + (j - 1) % SIM_SENT_REPORTS;
+        if (report->len == bank->len && !memcmp(report->data, bank->data, bank->len)) {
+            uint64_t sample = now - report->done;
+            ++age.samples;
+            age.sum += sample;
+            if (sample < age.min) {
+                age.min = sample;
+            }
+            if (sample > age.max) {
+                age.max = sample;
+            }
+            return;
+        }
+    }
+}
+
+static void usb_poll_in(uint8_t n, uint64_t now) {
+    struct bank * bank = ep[n].bank + ep[n].host;
+    if (!bank->ready) {
+        ep[n].nakin = 1;
+        return;
+    }
+    if (usb.in_tail - usb.in_head < SIM_IN_QUEUE_SIZE) {
+        uint32_t index = usb.in_tail++ % SIM_IN_QUEUE_SIZE;
+        usb.in[index].ep = ep[n].address;
+        usb.in[index].len = bank->len;
+        usb.in[index].at = now;
+        memcpy(usb.in[index].data, bank->data, bank->len);
+    }
+    if (verbose) {
+        char prefix[16];
+        snprintf(prefix, sizeof(prefix), "in%u<", n);
+        print_bytes(prefix, bank->data, bank->len);
+    }
+    age_sample(bank, now);
+    ++usb.in_reports;
+    bank->ready = 0;
+    ep[n].host = (ep[n].host + 1) % ep[n].banks;
+}
+
+static void usb_poll_out(uint8_t n) {
+    struct bank * bank = ep[n].bank + ep[n].host;
+    if (!usb.out_pending || bank->ready) {
+        return;
+    }
+    memcpy(bank->data, usb.out, usb.out_len);
+    bank->len = usb.out_len;
+    bank->ready = 1;
+    ep[n].host = (ep[n].host + 1) % ep[n].banks;
+    usb.out_pending = 0;
+    ++usb.out_reports;
+    if (verbose) {
+        char prefix[16];
+        snprintf(prefix, sizeof(prefix), "out%u>", n);
+        print_bytes(prefix, usb.out, usb.out_len);
+    }
+}
+
+static void usb_tokens(uint64_t now) {
+    uint8_t n;
+    if (USB_DeviceState != DEVICE_STATE_Configured) {
+        return;
+    }
+    for (n = 1; n < SIM_ENDPOINTS; ++n) {
+        if (!ep[n].configured || ep[n].type != EP_TYPE_INTERRUPT || ep[n].interval == 0
+                || usb.frame % ep[n].interval) {
+            continue;
+        }
+        if (ep[n].address & ENDPOINT_DIR_IN) {
+            usb_poll_in(n, now);
+        } else {
+            usb_poll_out(n);
+        }
+    }
+}
+
+static void usb_advance(uint64_t now) {
+    while (1) {
+        if (usb.tokens_at != 0 && usb.tokens_at <= now) {
+            usb_tokens(usb.tokens_at);
+            usb.tokens_at = 0;
+        } else if (usb.next_frame <= now) {
+            ++usb.frame;
+            if (usb.attached && usb.sof_enabled) {
+                usb.sof_pending = 1;
+            }
+            usb.tokens_at = usb.next_frame + SIM_TOKEN_DELAY_NS;
+            usb.next_frame += 1000000;
+        } else {
+            break;
+        }
+    }
+}
+
+/*
+ * Console on the SPI bus: attention, then one byte per SIM_SPI_BYTE_NS, each after the firmware handled the previous
+ * interrupt. The pin change and transfer interrupts are only pending while they are enabled.
+ */
+static void spi_advance(uint64_t now) {
+    if (spi.pcint_pending && !((PCICR & (1 << PCIE0)) && (PCMSK0 & (1 << PCINT0)))) {
+        spi.pcint_pending = 0;
+    }
+    if (spi.stc_pending && !((SPCR & (1 << SPE)) && (SPCR & (1 << SPIE)))) {
+        spi.stc_pending = 0;
+    }
+    if (!spi.active || spi.pcint_pending || spi.stc_pending || spi.next > now) {
+        return;
+    }
+    if (spi.pos < spi.len) {
+        uint8_t enabled = SPCR & (1 << SPE);
+        spi.miso[spi.pos] = enabled ? spi.tx : 0xff; // MISO is pulled up
+        if (enabled) {
+            spi.rx = spi.mosi[spi.pos];
+            spi.tx = spi.rx;
+            spi.stc_pending = 1;
+        }
+        ++spi.pos;
+        spi.next = now + SIM_SPI_BYTE_NS;
+        return;
+    }
+    PINB |= (1 << SIM_ATTENTION_PIN);
+    spi.pcint_pending = 1;
+    spi.active = 0;
+    spi.done = 1;
+    ++spi.transactions;
+}
+
+/*
+ * Hardware and interrupts.
+ */
+
+/*
+ * Only called with busy set, so the hidden time is never updated concurrently.
+ */
+static void world_advance(void) {
+    uint64_t start = raw_ns();
+    if (last_raw_ns && start - last_raw_ns > SIM_MAX_STEP_NS) {
+        hidden_ns += start - last_raw_ns - SIM_MAX_STEP_NS;
+    }
+    uint64_t now = start - hidden_ns;
+    uart_advance(now);
+    usb_advance(now);
+    spi_advance(now);
+    script_advance(now);
+    last_raw_ns = raw_ns();
+    hidden_ns += last_raw_ns - start;
+    ++clock_seq;
+}
+
+static void irq_off_begin(void) {
+    irq_off.active = 1;
+    irq_off.start = now_ns();
+}
+
+static void irq_off_end(void) {
+    uint64_t window = now_ns() - irq_off.start;
+    if (irq_off.active && window > irq_off.max) {
+        irq_off.max = window;
+    }
+    irq_off.active = 0;
+}
+
+/*
+ * An IN endpoint with TXINE has a free bank.
+ */
+static int usb_com_pending(void) {
+    uint8_t n;
+    for (n = 1; n < SIM_ENDPOINTS; ++n) {
+        if (ep[n].configured && (ep[n].ienx & (1 << TXINE)) && (ep[n].address & ENDPOINT_DIR_IN)
+                && !ep[n].bank[ep[n].fw].ready) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+static void dispatch(void) {
+    while (irq_enabled && !in_isr) {
+        void (*vector)(void) = NULL;
+        // claim the interrupt context before looking at the flags, a tick could run the vector meanwhile
+        in_isr = 1;
+        // vector priority order
+        if (PCINT0_vect && spi.pcint_pending) {
+            spi.pcint_pending = 0;
+            vector = PCINT0_vect;
+        } else if (EVENT_USB_Device_StartOfFrame && usb.sof_pending) {
+            usb.sof_pending = 0;
+            vector = EVENT_USB_Device_StartOfFrame;
+        } else if (USB_COM_vect && usb_com_pending()) {
+            vector = USB_COM_vect;
+        } else if (SPI_STC_vect && spi.stc_pending) {
+            spi.stc_pending = 0;
+            vector = SPI_STC_vect;
+        } else if (USART1_RX_vect && uart.fifo_count && (UCSR1B & (1 << RXCIE1))) {
+            vector = USART1_RX_vect;
+        } else if (USART1_UDRE_vect && !uart.hold_full && (UCSR1B & (1 << UDRIE1))) {
+            vector = USART1_UDRE_vect;
+        }
+        if (vector == NULL) {
+            in_isr = 0;
+            break;
+        }
+        irq_enabled = 0;
+        irq_off_begin();
+        vector();
+        busy = 1;
+        udr1_resolve();
+        spdr_resolve();
+        ucsr1a_resolve();
+        ueintx_resolve();
+        busy = 0;
+        irq_off_end();
+        irq_enabled = 1;
+        in_isr = 0;
+    }
+}
+
+/*
+ * Each stand-in function runs the hardware up to the current time.
+ */
+static void enter(void) {
+    busy = 1;
+    if (depth > 0) {
+        frames[depth - 1].io++; // nested interrupts have their own frame
+    }
+    udr1_resolve();
+    spdr_resolve();
+    ucsr1a_resolve();
+    ueintx_resolve();
+    world_advance();
+}
+
+static void leave(void) {
+    busy = 0;
+    dispatch();
+}
+
+static void tick(int signal) {
+    (void) signal;
+    if (busy) {
+        return;
+    }
+    int saved_errno = errno;
+    busy = 1;
+    world_advance();
+    busy = 0;
+    dispatch();
+    errno = saved_errno;
+}
+
+void sim_cli(void) {
+    if (irq_enabled && !in_isr) {
+        irq_off_begin();
+    }
+    irq_enabled = 0;
+}
+
+void sim_sei(void) {
+    if (!irq_enabled && !in_isr) {
+        irq_off_end();
+    }
+    irq_enabled = 1;
+    enter();
+    leave();
+}
+
+bool sim_irq_enabled(void) {
+    return irq_enabled;
+}
+
+void sim_watchdog_reset(void) {
+    busy = 1;
+    printf("%10.3f ms watchdog reset\n", now_ns() / 1e6);
+    fflush(stdout);
+    char path[] = "/tmp/sim-eeprom-XXXXXX";
+    ssize_t size = __stop_sim_eeprom - __start_sim_eeprom;
+    int fd = mkstemp(path);
+    if (fd < 0) {
+        perror("mkstemp");
+        finish(EXIT_WATCHDOG);
+    }
+    if (write(fd, __start_sim_eeprom, size) != size) {
+        perror("write");
+        close(fd);
+        unlink(path);
+        finish(EXIT_WATCHDOG);
+    }
+    close(fd);
+    char pc[16];
+    snprintf(pc, sizeof(pc), "%d", script.pc);
+    char * args[10];
+    int n = 0;
+    args[n++] = (char *) firmware;
+    if (verbose) {
+        args[n++] = "-v";
+    }
+    if (json_path) {
+        args[n++] = "-j";
+        args[n++] = (char *) json_path;
+    }
+    args[n++] = "-e";
+    args[n++] = path;
+    args[n++] = "-p";
+    args[n++] = pc;
+    args[n++] = (char *) script_path;
+    args[n] = NULL;
+    execv("/proc/self/exe", args);
+    perror("execv");
+    unlink(path);
+    finish(EXIT_WATCHDOG);
+}
+
+/*
+ * Erase the EEPROM, or load it after a watchdog reset.
+ */
+static void eeprom_init(void) {
+    ssize_t size = __stop_sim_eeprom - __start_sim_eeprom;
+    memset(__start_sim_eeprom, 0xff, size);
+    if (eeprom_path == NULL) {
+        return;
+    }
+    FILE * file = fopen(eeprom_path, "r");
+    if (file == NULL || fread(__start_sim_eeprom, 1, size, file) != (size_t) size) {
+        fprintf(stderr, "%s: can't load the EEPROM\n", eeprom_path);
+        exit(EXIT_USAGE);
+    }
+    fclose(file);
+    unlink(eeprom_path);
+}
+
+volatile uint16_t * sim_udr1(void) {
+    enter();
+    uart.cell = uart.cell_preload = 0x100 | (uart.fifo_count ? uart.fifo[0] : uart.last_rx);
+    uart.cell_pending = 1;
+    leave();
+    return &uart.cell;
+}
+
+volatile uint16_t * sim_spdr(void) {
+    enter();
+    spi.cell = spi.cell_preload = 0x100 | spi.rx;
+    spi.cell_pending = 1;
+    leave();
+    return &spi.cell;
+}
+
+void sim_delay_us(double us) {
+    uint64_t end = raw_ns() + us * 1000;
+    while (raw_ns() < end) {
+    }
+}
+
+volatile uint16_t * sim_ucsr1a(void) {
+    enter();
+    leave();
+    // after any pending interrupt, which would use the other cell anyway
+    typeof(*ucsr1a) * access = ucsr1a + (in_isr ? 1 : 0);
+    access->cell = access->preload = 0x100 | (uart.fifo_count ? (1 << RXC1) : 0) | (uart.txc ? (1 << TXC1) : 0)
+            | (uart.hold_full ? 0 : (1 << UDRE1)) | (uart.fe ? (1 << FE1) : 0) | (uart.dor ? (1 << DOR1) : 0)
+            | (uart.u2x ? (1 << U2X1) : 0);
+    access->pending = 1;
+    return &access->cell;
+}
+
+volatile uint16_t * sim_tcnt1(void) {
+    static const uint16_t prescalers[] = { 0, 1, 8, 64, 256, 1024, 0, 0 };
+    enter();
+    uint64_t now_ps = now_ns() * 1000;
+    uint16_t prescaler = prescalers[TCCR1B & 0x07];
+    if (prescaler) {
+        uint64_t tick_ps = prescaler * (1000000000000ULL / F_CPU);
+        uint64_t ticks = now_ps > timer1.last_ps ? (now_ps - timer1.last_ps) / tick_ps : 0;
+        timer1.counter += ticks;
+        timer1.last_ps += ticks * tick_ps;
+    } else {
+        timer1.last_ps = now_ps;
+    }
+    leave();
+    return &timer1.counter;
+}
+
+volatile uint8_t * sim_ueintx(void) {
+    enter();
+    leave();
+    // after any pending interrupt, which would use the other cell anyway
+    typeof(*ueintx) * access = ueintx + (in_isr ? 1 : 0);
+    struct bank * bank = ep[current_ep].bank + ep[current_ep].fw;
+    access->ep = current_ep;
+    access->cell = access->preload = (ep[current_ep].nakin ? (1 << NAKINI) : 0) | (bank->ready ? 0 : (1 << TXINI));
+    access->pending = 1;
+    return &access->cell;
+}
+
+volatile uint8_t * sim_ueienx(void) {
+    enter();
+    leave();
+    return &ep[current_ep].ienx;
+}
+
+/*
+ * Serial driver.
+ */
+
+void Serial_Init(const uint32_t BaudRate, const bool DoubleSpeed) {
+    enter();
+    UBRR1 = (DoubleSpeed ? SERIAL_2X_UBBRVAL(BaudRate) : SERIAL_UBBRVAL(BaudRate));
+    UCSR1C = ((1 << UCSZ11) | (1 << UCSZ10));
+    uart.u2x = DoubleSpeed;
+    UCSR1B = ((1 << TXEN1) | (1 << RXEN1));
+    DDRD |= (1 << 3);
+    PORTD |= (1 << 2);
+    leave();
+}
+
+void Serial_Disable(void) {
+    enter();
+    UCSR1B = 0;
+    UCSR1C = 0;
+    UBRR1 = 0;
+    uart.u2x = 0;
+    uart.fifo_count = 0;
+    DDRD &= ~(1 << 3);
+    PORTD &= ~(1 << 2);
+    leave();
+}
+
+bool Serial_IsCharReceived(void) {
+    return (UCSR1A & (1 << RXC1)) ? true : false;
+}
+
+bool Serial_IsSendReady(void) {
+    return (UCSR1A & (1 << UDRE1)) ? true : false;
+}
+
+void Serial_SendByte(const char DataByte) {
+    while (!Serial_IsSendReady());
+    enter();
+    uart_transmit(DataByte);
+    leave();
+}
+
+int16_t Serial_ReceiveByte(void) {
+    int16_t value = -1;
+    enter();
+    if (uart.fifo_count) {
+        value = uart.fifo[0];
+        uart.last_rx = value;
+        memmove(uart.fifo, uart.fifo + 1, --uart.fifo_count);
+        uart.fe = 0;
+    }
+    leave();
+    return value;
+}
+
+void Serial_SendData(const void * Buffer, uint16_t Length) {
+    const uint8_t * data = Buffer;
+    while (Length--) {
+        Serial_SendByte(*data++);
+    }
+}
+
+/*
+ * USB device controller.
+ */
+
+void USB_Init(void) {
+    enter();
+    USB_DeviceState = DEVICE_STATE_Powered;
+    usb.attached = 1;
+    leave();
+    EVENT_USB_Device_Connect();
+}
+
+/*
+ * Detach: the endpoints have to be configured again after the next enumeration.
+ */
+void USB_Disable(void) {
+    enter();
+    USB_DeviceState = DEVICE_STATE_Unattached;
+    usb.attached = 0;
+    usb.sof_enabled = 0;
+    usb.sof_pending = 0;
+    memset(ep, 0x00, sizeof(ep));
+    leave();
+}
+
+void USB_Device_EnableSOFEvents(void) {
+    usb.sof_enabled = 1;
+}
+
+void USB_Device_DisableSOFEvents(void) {
+    usb.sof_enabled = 0;
+}
+
+uint16_t USB_Device_GetFrameNumber(void) {
+    return usb.frame & 0x7ff;
+}
+
+static void standard_request(void) {
+    uint8_t type = USB_ControlRequest.bmRequestType;
+    if ((type & REQTYPE_MASK) != REQTYPE_STANDARD) {
+        return;
+    }
+    switch (USB_ControlRequest.bRequest) {
+    case REQ_GetDescriptor:
+        if (type & REQDIR_DEVICETOHOST) {
+            const void * address = NULL;
+            uint16_t size = CALLBACK_USB_GetDescriptor(USB_ControlRequest.wValue, USB_ControlRequest.wIndex, &address);
+            if (size != NO_DESCRIPTOR && address != NULL) {
+                Endpoint_ClearSETUP();
+                Endpoint_Write_Control_PStream_LE(address, size);
+                Endpoint_ClearOUT();
+            }
+        }
+        break;
+    case REQ_SetAddress:
+        Endpoint_ClearSETUP();
+        USB_DeviceState = DEVICE_STATE_Addressed;
+        Endpoint_ClearIN();
+        break;
+    case REQ_SetConfiguration:
+        Endpoint_ClearSETUP();
+        USB_DeviceState = USB_ControlRequest.wValue ? DEVICE_STATE_Configured : DEVICE_STATE_Addressed;
+        Endpoint_ClearIN();
+        EVENT_USB_Device_ConfigurationChanged();
+        break;
+    case REQ_GetConfiguration: {
+        uint8_t configuration = (USB_DeviceState == DEVICE_STATE_Configured);
+        Endpoint_ClearSETUP();
+        Endpoint_Write_Control_Stream_LE(&configuration, sizeof(configuration));
+        Endpoint_ClearOUT();
+        break;
+    }
+    case REQ_GetStatus: {
+        uint16_t status = 0;
+        Endpoint_ClearSETUP();
+        Endpoint_Write_Control_Stream_LE(&status, sizeof(status));
+        Endpoint_ClearOUT();
+        break;
+    }
+    case REQ_ClearFeature:
+    case REQ_SetFeature:
+        Endpoint_ClearSETUP();
+        Endpoint_ClearIN();
+        break;
+    }
+}
+
+void USB_USBTask(void) {
+    enter();
+    int pending = (ctrl.state == CONTROL_PENDING);
+    if (pending) {
+        ctrl.state = CONTROL_ACTIVE;
+        ctrl.cleared = 0;
+        ctrl.stalled = 0;
+        USB_ControlRequest = ctrl.setup;
+        ++usb.control_transfers;
+    }
+    leave();
+    if (!pending) {
+        return;
+    }
+    uint8_t previous = Endpoint_GetCurrentEndpoint();
+    Endpoint_SelectEndpoint(0);
+    if (EVENT_USB_Device_ControlRequest) {
+        EVENT_USB_Device_ControlRequest();
+    }
+    Endpoint_SelectEndpoint(0);
+    if (Endpoint_IsSETUPReceived()) {
+        standard_request();
+    }
+    if (Endpoint_IsSETUPReceived()) {
+        Endpoint_StallTransaction();
+    }
+    Endpoint_SelectEndpoint(previous);
+}
+
+bool Endpoint_ConfigureEndpoint(const uint8_t Address, const uint8_t Type, const uint16_t Size, const uint8_t Banks) {
+    uint8_t n = Address & ENDPOINT_EPNUM_MASK;
+    if (n == 0 || n >= SIM_ENDPOINTS || Size > SIM_ENDPOINT_SIZE || Banks < 1 || Banks > 2) {
+        return false;
+    }
+    enter();
+    uint8_t interval = ep[n].interval;
+    memset(ep + n, 0x00, sizeof(*ep));
+    ep[n].configured = 1;
+    ep[n].address = Address;
+    ep[n].type = Type;
+    ep[n].size = Size;
+    ep[n].banks = Banks;
+    ep[n].interval = interval;
+    current_ep = n;
+    leave();
+    return true;
+}
+
+void Endpoint_SelectEndpoint(const uint8_t Address) {
+    current_ep = Address & ENDPOINT_EPNUM_MASK;
+}
+
+uint8_t Endpoint_GetCurrentEndpoint(void) {
+    return current_ep | (ep[current_ep].address & ENDPOINT_DIR_IN);
+}
+
+uint8_t Endpoint_GetBusyBanks(void) {
+    uint8_t banks = 0;
+    enter();
+    if (current_ep) {
+        banks = ep[current_ep].bank[0].ready + ep[current_ep].bank[1].ready;
+    }
+    leave();
+    return banks;
+}
+
+bool Endpoint_IsINReady(void) {
+    bool ready = true;
+    enter();
+    if (current_ep) {
+        ready = !ep[current_ep].bank[ep[current_ep].fw].ready;
+    }
+    leave();
+    return ready;
+}
+
+bool Endpoint_IsOUTReceived(void) {
+    bool received = true;
+    enter();
+    if (current_ep) {
+        received = ep[current_ep].bank[ep[current_ep].fw].ready;
+    }
+    leave();
+    return received;
+}
+
+bool Endpoint_IsSETUPReceived(void) {
+    return current_ep == 0 && ctrl.state == CONTROL_ACTIVE && !ctrl.cleared;
+}
+
+bool Endpoint_IsReadWriteAllowed(void) {
+    bool allowed;
+    enter();
+    struct bank * bank = ep[current_ep].bank + ep[current_ep].fw;
+    if (ep[current_ep].address & ENDPOINT_DIR_IN) {
+        allowed = !bank->ready && ep[current_ep].pos < ep[current_ep].size;
+    } else {
+        allowed = bank->ready && ep[current_ep].pos < bank->len;
+    }
+    leave();
+    return allowed;
+}
+
+uint16_t Endpoint_BytesInEndpoint(void) {
+    struct bank * bank = ep[current_ep].bank + ep[current_ep].fw;
+    if (ep[current_ep].address & ENDPOINT_DIR_IN) {
+        return ep[current_ep].pos;
+    }
+    return bank->ready ? bank->len - ep[current_ep].pos : 0;
+}
+
+static void control_complete(void) {
+    ctrl.state = CONTROL_DONE;
+}
+
+/*
+ * Reset the FIFO of the endpoint: the banks the host did not read yet are lost.
+ */
+void Endpoint_ResetEndpoint(const uint8_t Address) {
+    uint8_t n = Address & ENDPOINT_EPNUM_MASK;
+    enter();
+    if (n && n < SIM_ENDPOINTS) {
+        ep[n].bank[0].ready = 0;
+        ep[n].bank[1].ready = 0;
+        ep[n].fw = 0;
+        ep[n].host = 0;
+        ep[n].pos = 0;
+    }
+    leave();
+}
+
+void Endpoint_ClearIN(void) {
+    enter();
+    if (current_ep == 0) {
+        if (ctrl.state == CONTROL_ACTIVE && !(ctrl.setup.bmRequestType & REQDIR_DEVICETOHOST)) {
+            control_complete();
+        }
+    } else {
+        struct bank * bank = ep[current_ep].bank + ep[current_ep].fw;
+        if (!bank->ready) {
+            bank->len = ep[current_ep].pos;
+            bank->ready = 1;
+            ep[current_ep].fw = (ep[current_ep].fw + 1) % ep[current_ep].banks;
+            ep[current_ep].pos = 0;
+        }
+    }
+    leave();
+}
+
+void Endpoint_ClearOUT(void) {
+    enter();
+    if (current_ep == 0) {
+        if (ctrl.state == CONTROL_ACTIVE && (ctrl.setup.bmRequestType & REQDIR_DEVICETOHOST)) {
+            control_complete();
+        }
+    } else {
+        struct bank * bank = ep[current_ep].bank + ep[current_ep].fw;
+        if (bank->ready) {
+            bank->ready = 0;
+            ep[current_ep].fw = (ep[current_ep].fw + 1) % ep[current_ep].banks;
+            ep[current_ep].pos = 0;
+        }
+    }
+    leave();
+}
+
+void Endpoint_ClearSETUP(void) {
+    enter();
+    if (current_ep == 0) {
+        ctrl.cleared = 1;
+    }
+    leave();
+}
+
+void Endpoint_StallTransaction(void) {
+    enter();
+    if (current_ep == 0 && ctrl.state == CONTROL_ACTIVE) {
+        ctrl.stalled = 1;
+        ctrl.in_len = 0;
+        control_complete();
+    }
+    leave();
+}
+
+uint8_t Endpoint_Read_8(void) {
+    uint8_t value = 0;
+    enter();
+    struct bank * bank = ep[current_ep].bank + ep[current_ep].fw;
+    if (bank->ready && ep[current_ep].pos < bank->len) {
+        value = bank->data[ep[current_ep].pos++];
+    }
+    leave();
+    return value;
+}
+
+void Endpoint_Write_8(const uint8_t Data) {
+    enter();
+    struct bank * bank = ep[current_ep].bank + ep[current_ep].fw;
+    if (!bank->ready && ep[current_ep].pos < ep[current_ep].size) {
+        bank->data[ep[current_ep].pos++] = Data;
+    }
+    leave();
+}
+
+static uint8_t wait_until_ready(void) {
+    uint64_t deadline = now_ns() + STREAM_TIMEOUT_MS * 1000000ULL;
+    while (1) {
+        if (USB_DeviceState != DEVICE_STATE_Configured) {
+            return ENDPOINT_RWSTREAM_DeviceDisconnected;
+        }
+        if ((ep[current_ep].address & ENDPOINT_DIR_IN) ? Endpoint_IsINReady() : Endpoint_IsOUTReceived()) {
+            return ENDPOINT_RWSTREAM_NoError;
+        }
+        if (now_ns() > deadline) {
+            return ENDPOINT_RWSTREAM_Timeout;
+        }
+    }
+}
+
+/*
+ * Same behavior as the LUFA stream templates (Template_Endpoint_RW.c).
+ */
+
+uint8_t Endpoint_Write_Stream_LE(const void * const Buffer, uint16_t Length, uint16_t * const BytesProcessed) {
+    const uint8_t * data = Buffer;
+    uint16_t transferred = 0;
+    uint8_t error;
+
+    if ((error = wait_until_ready())) {
+        return error;
+    }
+    if (BytesProcessed != NULL) {
+        Length -= *BytesProcessed;
+        data += *BytesProcessed;
+    }
+    while (Length) {
+        if (!Endpoint_IsReadWriteAllowed()) {
+            Endpoint_ClearIN();
+            if (BytesProcessed != NULL) {
+                *BytesProcessed += transferred;
+                return ENDPOINT_RWSTREAM_IncompleteTransfer;
+            }
+            if ((error = wait_until_ready())) {
+                return error;
+            }
+        } else {
+            Endpoint_Write_8(*data++);
+            Length--;
+            transferred++;
+        }
+    }
+    return ENDPOINT_RWSTREAM_NoError;
+}
+
+uint8_t Endpoint_Read_Stream_LE(void * const Buffer, uint16_t Length, uint16_t * const BytesProcessed) {
+    uint8_t * data = Buffer;
+    uint16_t transferred = 0;
+    uint8_t error;
+
+    if ((error = wait_until_ready())) {
+        return error;
+    }
+    if (BytesProcessed != NULL) {
+        Length -= *BytesProcessed;
+        data += *BytesProcessed;
+    }
+    while (Length) {
+        if (!Endpoint_IsReadWriteAllowed()) {
+            Endpoint_ClearOUT();
+            if (BytesProcessed != NULL) {
+                *BytesProcessed += transferred;
+                return ENDPOINT_RWSTREAM_IncompleteTransfer;
+            }
+            if ((error = wait_until_ready())) {
+                return error;
+            }
+        } else {
+            *data++ = Endpoint_Read_8();
+            Length--;
+            transferred++;
+        }
+    }
+    return ENDPOINT_RWSTREAM_NoError;
+}
+
+uint8_t Endpoint_Write_Control_Stream_LE(const void * const Buffer, uint16_t Length) {
+    enter();
+    if (Length > ctrl.setup.wLength) {
+        Length = ctrl.setup.wLength;
+    }
+    memcpy(ctrl.in, Buffer, Length);
+    ctrl.in_len = Length;
+    leave();
+    return ENDPOINT_RWCSTREAM_NoError;
+}
+
+uint8_t Endpoint_Write_Control_PStream_LE(const void * const Buffer, uint16_t Length) {
+    return Endpoint_Write_Control_Stream_LE(Buffer, Length);
+}
+
+uint8_t Endpoint_Read_Control_Stream_LE(void * const Buffer, uint16_t Length) {
+    enter();
+    if (Length > ctrl.out_len) {
+        Length = ctrl.out_len;
+    }
+    memcpy(Buffer, ctrl.out, Length);
+    leave();
+    return ENDPOINT_RWCSTREAM_NoError;
+}
+
+/*
+ * Results.
+ */
+
+/*
+ * Same results as machine-readable JSON. Times are host nanoseconds, with the "_host_ns" suffix: the firmware runs as
+ * instrumented host code, so they are not AVR cycles, and only compare with other runs on the same host. The hardware
+ * accesses per call ("functions_io") don't depend on the host.
+ */
+static void write_json(int status) {
+    unsigned int i;
+
+    FILE * file = fopen(json_path, "w");
+    if (file == NULL) {
+        perror(json_path);
+        return;
+    }
+    fprintf(file, "{\"firmware\": \"%s\", \"script\": \"%s\", \"status\": \"%s\",\n", firmware, script_path,
+            status == EXIT_PASS ? "pass" : "fail");
+    fprintf(file, " \"uart\": {\"rx_bytes\": %llu, \"tx_bytes\": %llu, \"overruns\": %llu, \"frame_errors\": %llu},\n",
+            (unsigned long long) uart.rx_bytes, (unsigned long long) uart.tx_bytes,
+            (unsigned long long) uart.overruns, (unsigned long long) uart.frame_errors);
+    fprintf(file, " \"usb\": {\"in_reports\": %llu, \"out_reports\": %llu, \"control_transfers\": %llu},\n",
+            (unsigned long long) usb.in_reports, (unsigned long long) usb.out_reports,
+            (unsigned long long) usb.control_transfers);
+    if (age.samples) {
+        fprintf(file, " \"in_report_age_host_ns\": {\"samples\": %llu, \"min\": %llu, \"avg\": %llu, \"max\": %llu},\n",
+                (unsigned long long) age.samples, (unsigned long long) age.min,
+                (unsigned long long) (age.sum / age.samples), (unsigned long long) age.max);
+    }
+    fprintf(file, " \"interrupts_disabled_max_host_ns\": %llu,\n", (unsigned long long) irq_off.max);
+    fprintf(file, " \"functions_host_ns\": {");
+    const char * separator = "";
+    for (i = 0; i < TRACKED_COUNT; ++i) {
+        if (tracked[i].calls == 0) {
+            continue;
+        }
+        fprintf(file, "%s\n  \"%s\": {\"calls\": %llu, \"min\": %llu, \"avg\": %llu, \"max\": %llu}", separator,
+                tracked[i].name, (unsigned long long) tracked[i].calls, (unsigned long long) tracked[i].min,
+                (unsigned long long) (tracked[i].sum / tracked[i].calls), (unsigned long long) tracked[i].max);
+        separator = ",";
+    }
+    fprintf(file, "},\n \"functions_io\": {");
+    separator = "";
+    for (i = 0; i < TRACKED_COUNT; ++i) {
+        if (tracked[i].calls == 0) {
+            continue;
+        }
+        fprintf(file, "%s\n  \"%s\": {\"min\": %llu, \"avg\": %.1f, \"max\": %llu}", separator, tracked[i].name,
+                (unsigned long long) tracked[i].io_min, (double) tracked[i].io_sum / tracked[i].calls,
+                (unsigned long long) tracked[i].io_max);
+        separator = ",";
+    }
+    fprintf(file, "}}\n");
+    fclose(file);
+}
+
+static void finish(int status) {
+    unsigned int i;
+
+    busy = 1;
+
+    printf("%s: %s\n", script_path, status == EXIT_PASS ? "PASS" : "FAIL");
+    printf("uart: %llu bytes received, %llu bytes sent, %llu overruns, %llu frame errors\n",
+            (unsigned long long) uart.rx_bytes, (unsigned long long) uart.tx_bytes,
+            (unsigned long long) uart.overruns, (unsigned long long) uart.frame_errors);
+    printf("usb: %llu IN reports, %llu OUT reports, %llu control transfers\n",
+            (unsigned long long) usb.in_reports, (unsigned long long) usb.out_reports,
+            (unsigned long long) usb.control_transfers);
+    if (spi.transactions) {
+        printf("spi: %llu transactions\n", (unsigned long long) spi.transactions);
+    }
+    if (age.samples) {
+        printf("IN report age (host time): %llu samples, min %.1f us, avg %.1f us, max %.1f us\n",
+                (unsigned long long) age.samples, age.min / 1e3, age.sum / 1e3 / age.samples, age.max / 1e3);
+    }
+    printf("interrupts disabled: max %llu host ns\n", (unsigned long long) irq_off.max);
+    printf("%-32s %10s %10s %10s %10s\n", "function (host ns)", "calls", "min", "avg", "max");
+    for (i = 0; i < TRACKED_COUNT; ++i) {
+        if (tracked[i].calls == 0) {
+            continue;
+        }
+        printf("%-32s %10llu %10llu %10llu %10llu\n", tracked[i].name, (unsigned long long) tracked[i].calls,
+                (unsigned long long) tracked[i].min, (unsigned long long) (tracked[i].sum / tracked[i].calls),
+                (unsigned long long) tracked[i].max);
+    }
+    printf("%-32s %10s %10s %10s\n", "function (hardware accesses)", "min", "avg", "max");
+    for (i = 0; i < TRACKED_COUNT; ++i) {
+        if (tracked[i].calls == 0) {
+            continue;
+        }
+        printf("%-32s %10llu %10.1f %10llu\n", tracked[i].name, (unsigned long long) tracked[i].io_min,
+                (double) tracked[i].io_sum / tracked[i].calls, (unsigned long long) tracked[i].io_max);
+    }
+    fflush(stdout);
+    if (json_path) {
+        write_json(status);
+    }
+    _exit(status);
+}
+
+static void usage(const char * program) {
+    fprintf(stderr, "usage: %s [-v] [-j results.json] [-e eeprom -p command] script\n", program);
+    exit(EXIT_USAGE);
+}
+
+int main(int argc, char * argv[]) {
+    int i;
+    for (i = 1; i < argc; ++i) {
+        if (!strcmp(argv[i], "-v")) {
+            verbose = 1;
+        } else if (!strcmp(argv[i], "-j") && i + 1 < argc) {
+            json_path = argv[++i];
+        } else if (!strcmp(argv[i], "-e") && i + 1 < argc) {
+            eeprom_path = argv[++i];
+        } else if (!strcmp(argv[i], "-p") && i + 1 < argc) {
+            resume_pc = atoi(argv[++i]);
+        } else if (script_path == NULL) {
+            script_path = argv[i];
+        } else {
+            usage(argv[0]);
+        }
+    }
+    if (script_path == NULL) {
+        usage(argv[0]);
+    }
+    firmware = strrchr(argv[0], '/') ? strrchr(argv[0], '/') + 1 : argv[0];
+    if (load_script(script_path) < 0) {
+        return EXIT_USAGE;
+    }
+    script.pc = resume_pc;
+    eeprom_init();
+
+    tracked[0].fn = USART1_RX_vect;
+    tracked[1].fn = USART1_UDRE_vect;
+    tracked[2].fn = SendNextReport;
+    tracked[3].fn = ReceiveNextReport;
+    tracked[4].fn = EVENT_USB_Device_ControlRequest;
+    tracked[5].fn = EVENT_USB_Device_StartOfFrame;
+    tracked[6].fn = SPI_STC_vect;
+    tracked[7].fn = PCINT0_vect;
+    tracked[8].fn = USB_COM_vect;
+
+    PINB = (1 << SIM_ATTENTION_PIN); // the console only asserts attention for its transactions
+
+    origin = 0;
+    origin = raw_ns();
+    usb.next_frame = 1000000;
+
+    struct sigaction action = { .sa_handler = tick, .sa_flags = SA_RESTART };
+    sigemptyset(&action.sa_mask);
+    sigaction(SIGALRM, &action, NULL);
+
+    timer_t timer;
+    struct sigevent event = { .sigev_notify = SIGEV_SIGNAL, .sigev_signo = SIGALRM };
+    if (timer_create(CLOCK_MONOTONIC, &event, &timer) < 0) {
+        perror("timer_create");
+        return EXIT_USAGE;
+    }
+    struct itimerspec period = { .it_interval = { 0, SIM_TICK_NS }, .it_value = { 0, SIM_TICK_NS } };
+    timer_settime(timer, 0, &period, NULL);
+
+    return emu_main();
+}
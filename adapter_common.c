@@ -3,11 +3,21 @@
  License: GPLv3
  */
 
+/*
+ * Multi-persona firmwares include the emu.c of several firmwares, which all include this file.
+ */
+#ifndef _ADAPTER_COMMON_C_
+#define _ADAPTER_COMMON_C_
+
 #include <stdint.h>
 #include <stdbool.h>
+#include <string.h>
 
 #include <avr/wdt.h>
+#include <avr/eeprom.h>
 #include <avr/power.h>
+#include <util/crc16.h>
+#include <util/atomic.h>
 
 #include <LUFA/Drivers/USB/USB.h>
 #include <LUFA/Drivers/Peripheral/Serial.h>
@@ -39,6 +49,38 @@
 #ifndef ADAPTER_OUT_INTERVAL
 #error ADAPTER_OUT_INTERVAL is not defined!
 #endif
+
+#ifndef ADAPTER_OUT_BANKS
+#define ADAPTER_OUT_BANKS 1
+#endif
+
+#ifndef ADAPTER_OUT_MAX_SIZE
+#define ADAPTER_OUT_MAX_SIZE ADAPTER_OUT_SIZE
+#endif
+#endif
+
+#ifndef ADAPTER_IN_BANKS
+#define ADAPTER_IN_BANKS 1
+#endif
+
+/*
+ * With ADAPTER_PERSONAS, the type and endpoint settings are read from the selected persona at runtime, and the
+ * buffers are sized for the largest endpoints.
+ */
+#ifndef ADAPTER_IN_MAX_SIZE
+#define ADAPTER_IN_MAX_SIZE ADAPTER_IN_SIZE
+#endif
+
+/*
+ * With ADAPTER_NO_USB, the adapter does not enumerate: the firmware serves the console over its own link, with these
+ * hooks. Frames are counted from Timer1 instead of the start of frame events, and the firmware calls
+ * Adapter_PollSeen() after each console poll, for the frame phase and the latency statistics.
+ */
+#ifdef ADAPTER_NO_USB
+void Adapter_Init(void); // instead of USB_Init(), once started
+void Adapter_Task(void); // from the main loop
+void Adapter_SendReport(const uint8_t * report, uint8_t len); // for the next console poll
+void Adapter_PollSeen(uint16_t time);
 #endif
 
 #define REQ_GetReport               0x01
@@ -48,35 +90,207 @@
 #define REPORT_TYPE_FEATURE 0x03
 
 #define MAX_CONTROL_TRANSFER_SIZE 64
+#define CONFIGURATION_MAX_SIZE 160
 
 #define USART_BAUDRATE 5 // 500Kbps
 #define USART_DOUBLE_SPEED true
+#define USART_BAUDRATE_MAX (F_CPU / 8 / 100000) // UBRR1 = 0 with double speed, 2Mbps at 16MHz
+
+#define RX_BUFFER_SIZE 256 // 5ms at 500Kbps, indexes wrap naturally
+#define TX_BUFFER_SIZE 256 // an OUT report and a spoofed control request, indexes wrap naturally
 
-const uint8_t version_major = 8;
-const uint8_t version_minor = 0;
+#define PACKET_TIMEOUT 2500 // 10ms at FCPU / 64
+#define DETACH_TIME 25000 // 100ms at FCPU / 64
+#define TIMER_TICK_US 4 // FCPU / 64
+#define FRAME_TICKS (1000 / TIMER_TICK_US) // 1ms frames
+#define BAUDRATE_TRIAL_TIMEOUT (BAUDRATE_TRIAL_TIMEOUT_MS * 1000U / TIMER_TICK_US)
+#define FRAMING_RECOVERY_TIMEOUT (FRAMING_RECOVERY_MS * 1000U / TIMER_TICK_US)
 
-static uint8_t report[ADAPTER_IN_SIZE] = {};
+#define LATENCY_BUCKETS 16
+#define LATENCY_BUCKET_SHIFT 7 // 512us buckets
+#define LATENCY_BUCKET_US (TIMER_TICK_US << LATENCY_BUCKET_SHIFT)
+
+#define REPORT_SLOTS 2
+
+#define SPOOF_TIMEOUT 1000 // frames
+
+const uint8_t version_major = 9;
+const uint8_t version_minor = 12;
+
+/*
+ * IN report slots: the packet parser fills reports[reportFill] while reports[reportReady] holds the last complete
+ * report. Completing a report swaps the indexes, so that the newest report is sent on the next IN token.
+ */
+static uint8_t reports[REPORT_SLOTS][ADAPTER_IN_MAX_SIZE] = {};
+static uint8_t reportLens[REPORT_SLOTS] = {};
+static uint16_t reportTimes[REPORT_SLOTS] = {}; // Timer1 when the report was complete
+static uint8_t reportFill = 0;
+static uint8_t reportReady = 1;
+static uint16_t reportsDropped = 0; // complete reports replaced before being sent
+static uint8_t deltaBase = 0; // the last complete report is the one known by the host
+
+/*
+ * IN polling: polls of the previous frame are detected at each start of frame, either because the report in the
+ * endpoint bank was read, or because the empty endpoint was NAKed. The host polls every pollPeriod frames, which is at
+ * most ADAPTER_IN_INTERVAL, the last poll was in frame lastPoll.
+ * These variables are used in both the main loop and the USB interrupt.
+ */
+static volatile uint8_t frameCount = 0;
+static volatile uint16_t frameStart = 0; // Timer1 at the last start of frame
+static volatile uint8_t lastPoll = 0;
+static volatile uint8_t pollValid = 0;
+static volatile uint8_t pollPeriod = 0; // 0 until measured
+static volatile uint8_t inFlight = 0; // a report is in the endpoint bank
+static volatile uint16_t inTime = 0; // Timer1 when the report in the endpoint bank was complete
+static uint8_t inInterval = 0; // requested by the host, 0 for ADAPTER_IN_INTERVAL
+
+/*
+ * Staged IN report: while the endpoint bank is free, a full IN report is also written to it as it is parsed, so that
+ * sending it only takes clearing the bank. A newer report or a parsing error resets the bank.
+ * With double banking, a report can be staged while the host did not read the previous one yet, and resetting the
+ * endpoint would drop that one too: the staged report is then stale until the previous one is read.
+ */
+static enum {
+    BANK_EMPTY,
+    BANK_FILLING,
+    BANK_STAGED,
+    BANK_STALE,
+} bankState = BANK_EMPTY;
+
+/*
+ * IN report policy set by the host, in frames. The console read reports[reportReady] if reportKnown is set.
+ * The main loop counts the frames since the last report was sent, and since the last byte was received.
+ */
+static uint8_t policyFlags = 0;
+static uint16_t keepAliveFrames = 0;
+static uint16_t silenceFrames = 0;
+static uint8_t neutralReport[ADAPTER_IN_MAX_SIZE];
+static uint8_t neutralLen = 0;
+static uint8_t neutralSent = 0;
+static uint8_t reportKnown = 0;
+static uint8_t policyFrame = 0;
+static uint8_t policyHead = 0;
+static uint16_t idleFrames = 0;
+static uint16_t quietFrames = 0;
+
+/*
+ * Time from the completion of a report to its IN transfer, the last bucket counts the longer times.
+ */
+static uint16_t latencies[LATENCY_BUCKETS] = {};
 
-static uint8_t buf[MAX_CONTROL_TRANSFER_SIZE];
+static uint8_t buf[MAX_CONTROL_TRANSFER_SIZE + 1]; // + the control reply tag
 
 static uint8_t *pdata;
 static uint8_t i = 0;
 
 /*
+ * Receive ring: the serial interrupt only writes rx_head, the main loop only writes rx_tail.
  * These variables are used in both the main and serial interrupt,
  * therefore they have to be declared as volatile.
+ * With framing, the bytes of the frame being parsed (from rx_tail to rx_pos) stay in the ring,
+ * so that parsing can restart right after a false start of frame.
  */
-static volatile uint8_t sendReport = 0;
-static volatile uint8_t reportLen = 0;
-static volatile uint8_t started = 0;
-static volatile uint8_t packet_type = 0;
-static volatile uint8_t value_len = 0;
-static volatile uint8_t spoofReply = 0;
-static volatile uint8_t spoofReplyLen = 0;
-static volatile uint8_t spoof_initialized = BYTE_STATUS_NSPOOFED;
+static uint8_t rx_buffer[RX_BUFFER_SIZE];
+static volatile uint8_t rx_head = 0;
+static volatile uint8_t rx_tail = 0;
+static uint8_t rx_pos = 0;
+
+static volatile uint8_t framing = 0; // protocol version 9 framing, negotiated with BYTE_VERSION
+
+/*
+ * Transmit ring: the main loop only writes tx_head, the serial interrupt only writes tx_tail.
+ */
+static uint8_t tx_buffer[TX_BUFFER_SIZE];
+static volatile uint8_t tx_head = 0;
+static volatile uint8_t tx_tail = 0;
+static volatile uint8_t tx_sent = 0; // TXC1 was cleared with the last byte, and is set once it is sent
+
+static enum {
+    RX_STATE_TYPE,
+    RX_STATE_LENGTH,
+    RX_STATE_VALUE,
+    RX_STATE_START,
+    RX_STATE_SEQUENCE,
+    RX_STATE_BATCH,
+    RX_STATE_CRC_LOW,
+    RX_STATE_CRC_HIGH,
+    RX_STATE_DRAIN, // bytes are dropped until the line is quiet for PACKET_TIMEOUT
+} rx_state = RX_STATE_TYPE;
+
+static uint16_t rx_start = 0; // Timer1 at the start of the packet being parsed
+static uint8_t rx_sequence = 0;
+static uint8_t rx_expected = 0;
+static uint16_t rx_crc = 0;
+static uint8_t rx_batch = 0; // position of the value of a batch, which stays in the ring until the frame is checked
+static uint16_t framesDropped = 0; // bad frames
+static uint16_t framesLost = 0; // sequence number gaps
+
+/*
+ * Framing recovery: consecutive bad frames, and Timer1 ticks since the last good frame (up to
+ * FRAMING_RECOVERY_TIMEOUT), counted from the main loop.
+ */
+static uint8_t framesBad = 0;
+static uint16_t framingIdle = 0;
+static uint16_t framingCheck = 0; // Timer1 at the last update of framingIdle
+
+/*
+ * Baudrate trial: the previous baudrate is restored at the timeout unless the host confirms the new one.
+ * The serial interrupt counts the frame and overrun errors.
+ */
+static enum {
+    BAUDRATE_TRIAL_NONE,
+    BAUDRATE_TRIAL_RUNNING,
+    BAUDRATE_TRIAL_FAILED,
+} baudrateTrial = BAUDRATE_TRIAL_NONE;
+
+static uint8_t baudrateFallback = 0;
+static uint16_t baudrateStart = 0;
+static volatile uint8_t rxErrors = 0;
+
+static const uint8_t baudratePattern[BAUDRATE_TEST_PATTERN_SIZE] PROGMEM = BAUDRATE_TEST_PATTERN;
+
+static enum {
+    TX_STATE_TYPE,
+    TX_STATE_LENGTH,
+    TX_STATE_VALUE,
+} tx_state = TX_STATE_TYPE;
+
+static uint8_t tx_remaining = 0;
+static uint8_t tx_sequence = 0;
+static uint16_t tx_crc = 0;
+
+static uint8_t sendReport = 0;
+static uint8_t started = 0;
+static uint8_t packet_type = 0;
+static uint8_t value_len = 0;
+static uint8_t spoof_initialized = BYTE_STATUS_NSPOOFED;
+/*
+ * Deferred control transfer: the data stage of a spoofed request is NAKed until the reply is received from the host,
+ * and the main loop keeps running meanwhile.
+ */
+static uint8_t controlDeferred = 0;
+static uint8_t controlFrame = 0;
+static uint16_t controlFrames = 0;
+static uint8_t controlTag = 0; // with framing, forwarded requests and their replies start with this tag
+static uint8_t controlSpoofs = 0; // the adapter is spoofed once the reply to the deferred request is sent
 volatile uint16_t vid = 0;
 volatile uint16_t pid = 0;
-static volatile uint8_t baudrate = USART_BAUDRATE;
+static uint8_t baudrate = USART_BAUDRATE;
+
+/*
+ * State saved by the host for the cached start, valid if magic is CACHED_START_MAGIC.
+ */
+struct cached_start {
+    uint8_t magic;
+    uint8_t spoofStatus;
+    uint8_t inInterval;
+    uint16_t vid;
+    uint16_t pid;
+};
+
+#define CACHED_START_MAGIC 0x5a
+
+static struct cached_start EEMEM cachedStart;
 
 void forceHardReset(void) {
     cli(); // disable interrupts
@@ -84,54 +298,606 @@ void forceHardReset(void) {
     while (1) {} // wait for watchdog to reset processor
 }
 
-static inline bool Serial_WaitByte(volatile uint8_t * byte) {
-    do {
-      if (Serial_IsCharReceived()) {
-          *byte = UDR1;
-          return true;
+/*
+ * Timer1 is also read by the USB interrupt, 16-bit reads must not be interrupted.
+ */
+static inline uint16_t timer_read(void) {
+    uint16_t value;
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+        value = TCNT1;
+    }
+    return value;
+}
+
+ISR(USART1_UDRE_vect) {
+
+    uint8_t tail = tx_tail;
+
+    if (tail == tx_head) {
+        UCSR1B &= ~(1 << UDRIE1); // nothing left to send
+        return;
+    }
+
+    UDR1 = tx_buffer[tail];
+    tail = (tail + 1) % TX_BUFFER_SIZE;
+    tx_tail = tail;
+
+    if (tail == tx_head) {
+        UCSR1B &= ~(1 << UDRIE1);
+        // the last byte is in the data register, so TXC1 can only be set once it is sent
+        UCSR1A = (1 << TXC1) | (USART_DOUBLE_SPEED << U2X1);
+        tx_sent = 1;
+    }
+}
+
+static inline uint8_t Serial_QueueFree(void) {
+    return (uint8_t) (TX_BUFFER_SIZE - 1 - (uint8_t) (tx_head - tx_tail));
+}
+
+static void tx_push(const uint8_t byte) {
+
+    uint8_t head = tx_head;
+    uint8_t next = (head + 1) % TX_BUFFER_SIZE;
+
+    while (next == tx_tail) {}
+
+    tx_buffer[head] = byte;
+    tx_head = next;
+
+    UCSR1B |= (1 << UDRIE1);
+}
+
+/*
+ * Queue a byte for transmission by the data register empty interrupt.
+ * This only waits if the transmit ring is full.
+ * With framing, packets (type, length, value) are wrapped into frames as their bytes are queued.
+ */
+void Serial_QueueByte(const uint8_t byte) {
+
+    if (!framing) {
+        tx_push(byte);
+        return;
+    }
+
+    switch (tx_state) {
+    case TX_STATE_TYPE:
+        tx_push(BYTE_FRAME_START);
+        tx_push(tx_sequence);
+        tx_crc = _crc_ccitt_update(FRAME_CRC_INIT, tx_sequence++);
+        tx_state = TX_STATE_LENGTH;
+        break;
+    case TX_STATE_LENGTH:
+        tx_remaining = byte;
+        tx_state = TX_STATE_VALUE;
+        break;
+    case TX_STATE_VALUE:
+        --tx_remaining;
+        break;
+    }
+
+    tx_push(byte);
+    tx_crc = _crc_ccitt_update(tx_crc, byte);
+
+    if (tx_state == TX_STATE_VALUE && tx_remaining == 0) {
+        tx_push(tx_crc & 0xff);
+        tx_push(tx_crc >> 8);
+        tx_state = TX_STATE_TYPE;
+    }
+}
+
+void Serial_QueueData(const void * data, uint16_t length) {
+
+    const uint8_t * bytes = data;
+
+    while (length--) {
+        Serial_QueueByte(*bytes++);
+    }
+}
+
+/*
+ * Wait for the transmit ring to be empty.
+ */
+static inline void Serial_Flush(void) {
+    while (tx_tail != tx_head) {}
+}
+
+static inline void send_spoof_header(void) {
+    uint8_t len = sizeof(USB_ControlRequest);
+    if (!(USB_ControlRequest.bmRequestType & REQDIR_DEVICETOHOST)) {
+        len += USB_ControlRequest.wLength & 0xFF;
+    }
+    Serial_QueueByte(BYTE_CONTROL_DATA);
+    if (framing) {
+        Serial_QueueByte(len + 1);
+        Serial_QueueByte(++controlTag);
+    } else {
+        Serial_QueueByte(len);
+    }
+    Serial_QueueData(&USB_ControlRequest, sizeof(USB_ControlRequest));
+}
+
+/*
+ * Complete the deferred control transfer with the reply from the host.
+ */
+static inline void control_reply(const uint8_t * data, uint8_t len) {
+
+    uint8_t spoofs = controlSpoofs;
+
+    controlDeferred = 0;
+    controlSpoofs = 0;
+
+    Endpoint_SelectEndpoint(ENDPOINT_CONTROLEP);
+
+    if (Endpoint_IsSETUPReceived()) {
+        return; // the host gave up, and sent a new request
+    }
+
+    if (Endpoint_Write_Control_Stream_LE(data, len) == ENDPOINT_RWCSTREAM_NoError) {
+        Endpoint_ClearOUT();
+        if (spoofs) {
+            spoof_initialized = BYTE_STATUS_SPOOFED;
         }
-  } while (TCNT1 < 625);
-  return false;
+    }
+}
+
+/*
+ * Forward the current device to host control request to the host, and return without waiting for the reply:
+ * the transfer is completed when the reply is received, or stalled by Control_Task() after SPOOF_TIMEOUT.
+ * This has to be called from EVENT_USB_Device_ControlRequest(), instead of clearing the setup packet.
+ */
+static inline void spoof_deferred(void) {
+
+    send_spoof_header();
+    Endpoint_ClearSETUP();
+
+    controlDeferred = 1;
+    controlFrame = frameCount;
+    controlFrames = 0;
+}
+
+/*
+ * Replies to device to host control requests, in program memory, sorted by key.
+ */
+struct control_entry {
+    uint32_t key;
+    const void * data;
+    uint8_t len;
+    uint8_t flags;
+};
+
+#define CONTROL_FLAG_SPOOF 0x01 // forward the request to the host
+
+#define CONTROL_KEY(bmRequestType, bRequest, wValue) \
+    (((uint32_t) (bmRequestType) << 24) | ((uint32_t) (bRequest) << 16) | (uint16_t) (wValue))
+
+#define CONTROL_REPLY(bmRequestType, bRequest, wValue, data) \
+    { CONTROL_KEY(bmRequestType, bRequest, wValue), data, sizeof(data), 0 }
+#define CONTROL_SPOOF(bmRequestType, bRequest, wValue) \
+    { CONTROL_KEY(bmRequestType, bRequest, wValue), NULL, 0, CONTROL_FLAG_SPOOF }
+
+#define FEATURE_REPLY(reportId, data) \
+    CONTROL_REPLY(REQDIR_DEVICETOHOST | REQTYPE_CLASS | REQREC_INTERFACE, REQ_GetReport, \
+            (REPORT_TYPE_FEATURE << 8) | (reportId), data)
+#define FEATURE_SPOOF(reportId) \
+    CONTROL_SPOOF(REQDIR_DEVICETOHOST | REQTYPE_CLASS | REQREC_INTERFACE, REQ_GetReport, \
+            (REPORT_TYPE_FEATURE << 8) | (reportId))
+
+/*
+ * Handle the current control request if it is in the table, returns false otherwise.
+ */
+bool control_dispatch(const struct control_entry * table, uint8_t count) {
+
+    uint32_t key = CONTROL_KEY(USB_ControlRequest.bmRequestType, USB_ControlRequest.bRequest,
+            USB_ControlRequest.wValue);
+    uint8_t low = 0;
+    uint8_t high = count;
+
+    while (low < high) {
+
+        uint8_t middle = (low + high) / 2;
+        uint32_t entry = pgm_read_dword(&table[middle].key);
+
+        if (entry < key) {
+            low = middle + 1;
+        } else if (entry > key) {
+            high = middle;
+        } else if (pgm_read_byte(&table[middle].flags) & CONTROL_FLAG_SPOOF) {
+            spoof_deferred();
+            return true;
+        } else {
+            Endpoint_ClearSETUP();
+            Endpoint_Write_Control_PStream_LE(pgm_read_ptr(&table[middle].data), pgm_read_byte(&table[middle].len));
+            Endpoint_ClearOUT();
+            return true;
+        }
+    }
+
+    return false;
+}
+
+#define CONTROL_DISPATCH(table) control_dispatch(table, sizeof(table) / sizeof(*(table)))
+
+static inline uint8_t in_interval(void) {
+    return inInterval ? inInterval : ADAPTER_IN_INTERVAL;
+}
+
+/*
+ * Reply the configuration descriptor with the IN polling interval requested by the host, from a RAM copy.
+ * Returns false if the request is not for this descriptor, or if the interval is the one of the descriptor.
+ */
+bool descriptor_request(void) {
+
+    uint8_t descriptor[CONFIGURATION_MAX_SIZE];
+    const void * address = NULL;
+    uint16_t size;
+    uint16_t i;
+
+    if (!inInterval || USB_ControlRequest.bmRequestType != (REQDIR_DEVICETOHOST | REQTYPE_STANDARD | REQREC_DEVICE)
+            || USB_ControlRequest.bRequest != REQ_GetDescriptor || (USB_ControlRequest.wValue >> 8) != DTYPE_Configuration) {
+        return false;
+    }
+
+    size = CALLBACK_USB_GetDescriptor(USB_ControlRequest.wValue, USB_ControlRequest.wIndex, &address);
+    if (size == NO_DESCRIPTOR || size > sizeof(descriptor)) {
+        return false;
+    }
+
+    memcpy_P(descriptor, address, size);
+
+    for (i = 0; i + sizeof(USB_Descriptor_Header_t) <= size && descriptor[i] >= sizeof(USB_Descriptor_Header_t);
+            i += descriptor[i]) {
+        USB_Descriptor_Endpoint_t * endpoint = (USB_Descriptor_Endpoint_t *) (descriptor + i);
+        if (endpoint->Header.Type == DTYPE_Endpoint && i + sizeof(*endpoint) <= size
+                && endpoint->EndpointAddress == ADAPTER_IN_NUM) {
+            endpoint->PollingIntervalMS = inInterval;
+        }
+    }
+
+    Endpoint_ClearSETUP();
+    Endpoint_Write_Control_Stream_LE(descriptor, size);
+    Endpoint_ClearOUT();
+    return true;
+}
+
+static inline void bank_reset(void) {
+    if (inFlight) {
+        bankState = BANK_STALE;
+        return;
+    }
+    Endpoint_ResetEndpoint(ADAPTER_IN_NUM);
+    bankState = BANK_EMPTY;
+}
+
+/*
+ * No report is waiting for the host in the IN endpoint. With double banking, the endpoint accepts a second report
+ * meanwhile, which is only staged: sending it would queue it behind an older report.
+ */
+static inline bool in_bank_idle(void) {
+#if ADAPTER_IN_BANKS > 1
+    return Endpoint_GetBusyBanks() == 0;
+#else
+    return Endpoint_IsINReady();
+#endif
+}
+
+/*
+ * Start writing the IN report being parsed to the endpoint bank, if it is free.
+ */
+static inline void bank_fill(void) {
+    if (bankState != BANK_EMPTY) {
+        bank_reset();
+    }
+#ifndef ADAPTER_NO_USB
+    Endpoint_SelectEndpoint(ADAPTER_IN_NUM);
+    if (bankState == BANK_EMPTY && USB_DeviceState == DEVICE_STATE_Configured
+            && (ADAPTER_IN_BANKS > 1 || !inFlight) && Endpoint_IsINReady()) {
+        bankState = BANK_FILLING;
+    }
+#endif
+}
+
+/*
+ * Drop the IN report being written to the endpoint bank, if any.
+ */
+static inline void bank_drop(void) {
+    if (bankState == BANK_FILLING) {
+        bank_reset();
+    }
+}
+
+/*
+ * The report being published is the one the console read last.
+ */
+static inline bool report_duplicate(uint8_t len) {
+    return (policyFlags & REPORT_POLICY_SUPPRESS_DUPLICATES) && reportKnown && !sendReport
+            && len == reportLens[reportReady] && !memcmp(reports[reportFill], reports[reportReady], len);
+}
+
+static inline void publish_report(uint8_t len) {
+    if (report_duplicate(len)) {
+        bank_drop();
+        return;
+    }
+    if (bankState == BANK_FILLING) {
+        bankState = BANK_STAGED;
+    } else if (bankState == BANK_STAGED) {
+        bank_reset(); // deltas and batched reports are not staged
+    }
+    if (sendReport) {
+        ++reportsDropped;
+    }
+    reportLens[reportFill] = len;
+    reportTimes[reportFill] = timer_read();
+    reportReady = reportFill;
+    reportFill = (reportFill + 1) % REPORT_SLOTS;
+    sendReport = 1;
+}
+
+/*
+ * Build the next report from the last complete one and the (offset, count, bytes) runs in buf.
+ * Malformed deltas are ignored.
+ */
+static inline void apply_report_delta(void) {
+
+    uint8_t * report = reports[reportFill];
+    uint8_t len = reportLens[reportReady];
+    uint8_t pos = 0;
+
+    if (!deltaBase) {
+        return; // a report was lost, wait for a full report
+    }
+
+    memcpy(report, reports[reportReady], len);
+
+    while (pos < value_len) {
+        if (value_len - pos < 2) {
+            return;
+        }
+        uint8_t offset = buf[pos++];
+        uint8_t count = buf[pos++];
+        if (count > value_len - pos || offset > len || count > len - offset) {
+            return;
+        }
+        memcpy(report + offset, buf + pos, count);
+        pos += count;
+    }
+
+    publish_report(len);
+}
+
+/*
+ * Report the IN polling phase, so that the host can complete its reports right before the frame preceding a poll.
+ */
+static inline void send_frame_phase(void) {
+
+    uint8_t frames;
+    uint16_t elapsed;
+
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+        frames = frameCount - lastPoll;
+        elapsed = (TCNT1 - frameStart) * TIMER_TICK_US;
+    }
+
+    Serial_QueueByte(BYTE_FRAME_PHASE);
+    Serial_QueueByte(4);
+    Serial_QueueByte(pollPeriod);
+    Serial_QueueByte(frames);
+    Serial_QueueByte(elapsed & 0xff);
+    Serial_QueueByte(elapsed >> 8);
+}
+
+/*
+ * Reply to BYTE_STATS, and clear the statistics if requested.
+ */
+static inline void send_stats(void) {
+
+    uint8_t clear = value_len > 0 && buf[0];
+
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+        memcpy(buf, latencies, sizeof(latencies));
+        if (clear) {
+            memset(latencies, 0x00, sizeof(latencies));
+        }
+    }
+
+    Serial_QueueByte(BYTE_STATS);
+    Serial_QueueByte(2 + sizeof(latencies) + 3 * sizeof(uint16_t));
+    Serial_QueueByte(LATENCY_BUCKET_US & 0xff);
+    Serial_QueueByte(LATENCY_BUCKET_US >> 8);
+    Serial_QueueData(buf, sizeof(latencies));
+    Serial_QueueData(&reportsDropped, sizeof(reportsDropped));
+    Serial_QueueData(&framesDropped, sizeof(framesDropped));
+    Serial_QueueData(&framesLost, sizeof(framesLost));
+
+    if (clear) {
+        reportsDropped = 0;
+        framesDropped = 0;
+        framesLost = 0;
+    }
+}
+
+/*
+ * A baudrate value of 0 would divide by zero in Serial_Init(), higher values than USART_BAUDRATE_MAX give UBRR1 = 0.
+ */
+static inline bool baudrate_valid(uint8_t rate) {
+    return rate > 0 && rate <= USART_BAUDRATE_MAX;
+}
+
+/*
+ * Switch to a new baudrate, in 100Kbps units, once the queued bytes are sent.
+ */
+static void serial_configure(uint8_t rate) {
+
+    Serial_Flush();
+    if (tx_sent) {
+        while (!(UCSR1A & (1 << TXC1))) {} // the last byte is sent
+        tx_sent = 0;
+    }
+
+    baudrate = rate;
+    PORTD |= (1 << 3); // keep TX high while reconfiguring
+    Serial_Disable();
+    Serial_Init(baudrate * 100000U, true);
+    PORTD &= ~(1 << 3); // release TX
+    UCSR1B |= (1 << RXCIE1); // Enable the USART Receive Complete interrupt (USART_RXC)
+}
+
+static inline void baudrate_trial_start(uint8_t rate) {
+
+    if (baudrateTrial == BAUDRATE_TRIAL_NONE) {
+        baudrateFallback = baudrate;
+    }
+    serial_configure(rate);
+    rxErrors = 0;
+    baudrateStart = timer_read();
+    baudrateTrial = BAUDRATE_TRIAL_RUNNING;
+}
+
+/*
+ * Echo a valid test pattern, or confirm the baudrate if there is no value.
+ */
+static inline void baudrate_test(void) {
+
+    if (value_len == 0) {
+        baudrateTrial = BAUDRATE_TRIAL_NONE;
+    } else {
+        uint8_t j;
+        for (j = 0; j < value_len; ++j) {
+            if (buf[j] != pgm_read_byte(baudratePattern + j % BAUDRATE_TEST_PATTERN_SIZE)) {
+                if (baudrateTrial != BAUDRATE_TRIAL_NONE) {
+                    baudrateTrial = BAUDRATE_TRIAL_FAILED;
+                }
+                return;
+            }
+        }
+    }
+
+    Serial_QueueByte(BYTE_BAUDRATE_TEST);
+    Serial_QueueByte(value_len);
+    Serial_QueueData(buf, value_len);
+}
+
+/*
+ * Select the destination of the value of the packet being parsed, NULL if the value is too long.
+ */
+static inline uint8_t * packet_data(void) {
+
+    if (packet_type == BYTE_IN_REPORT) {
+        return value_len <= ADAPTER_IN_SIZE ? reports[reportFill] : NULL;
+    }
+    return value_len <= sizeof(buf) ? buf : NULL;
+}
+
+static void cached_start_save(uint8_t enable) {
+
+    struct cached_start state = {
+        .magic = enable ? CACHED_START_MAGIC : 0x00,
+        .spoofStatus = spoof_initialized,
+        .inInterval = inInterval,
+        .vid = vid,
+        .pid = pid,
+    };
+    eeprom_update_block(&state, &cachedStart, sizeof(state));
+}
+
+/*
+ * Start with the saved state, if the host enabled the cached start.
+ */
+static inline void cached_start_load(void) {
+
+    struct cached_start state;
+    eeprom_read_block(&state, &cachedStart, sizeof(state));
+
+    if (state.magic == CACHED_START_MAGIC) {
+        spoof_initialized = state.spoofStatus;
+        inInterval = state.inInterval;
+        vid = state.vid;
+        pid = state.pid;
+        started = 1;
+    }
+}
+
+#ifdef ADAPTER_PERSONAS
+/*
+ * Switch to the persona of an adapter type, and re-enumerate if the adapter is started.
+ */
+static void persona_switch(uint8_t type) {
+
+    if (type == ADAPTER_TYPE || !Persona_Select(type)) {
+        return;
+    }
+
+    if (!started) {
+        return;
+    }
+
+    USB_Disable();
+
+    sendReport = 0;
+    memset(reportLens, 0x00, sizeof(reportLens));
+    deltaBase = 0;
+    bankState = BANK_EMPTY;
+    inFlight = 0;
+    controlDeferred = 0;
+    controlSpoofs = 0;
+    spoof_initialized = BYTE_STATUS_NSPOOFED;
+    neutralLen = 0;
+
+    uint16_t start = timer_read();
+    while ((uint16_t) (timer_read() - start) < DETACH_TIME) {} // let the host notice the disconnection
+
+    USB_Init();
 }
+#endif
 
-static inline void send_spoof_header(void) {
-    Serial_SendByte(BYTE_CONTROL_DATA);
-    if (USB_ControlRequest.bmRequestType & REQDIR_DEVICETOHOST) {
-        Serial_SendByte(sizeof(USB_ControlRequest));
-    } else {
-        Serial_SendByte(sizeof(USB_ControlRequest) + (USB_ControlRequest.wLength & 0xFF));
-    }
-    Serial_SendData(&USB_ControlRequest, sizeof(USB_ControlRequest));
-}
+static void handle_batch(void);
 
 static inline void handle_packet(void) {
     switch (packet_type) {
     case BYTE_TYPE:
-        Serial_SendByte(BYTE_TYPE);
-        Serial_SendByte(BYTE_LEN_1_BYTE);
-        Serial_SendByte(ADAPTER_TYPE);
+#ifdef ADAPTER_PERSONAS
+        if (value_len > 0) {
+            persona_switch(buf[0]);
+        }
+#endif
+        Serial_QueueByte(BYTE_TYPE);
+        Serial_QueueByte(BYTE_LEN_1_BYTE);
+        Serial_QueueByte(ADAPTER_TYPE);
         break;
     case BYTE_STATUS:
-        Serial_SendByte(BYTE_STATUS);
-        Serial_SendByte(BYTE_LEN_1_BYTE);
-        Serial_SendByte(spoof_initialized);
+        Serial_QueueByte(BYTE_STATUS);
+        Serial_QueueByte(BYTE_LEN_1_BYTE);
+        Serial_QueueByte(spoof_initialized);
         break;
     case BYTE_START:
-        Serial_SendByte(BYTE_START);
-        Serial_SendByte(BYTE_LEN_1_BYTE);
-        Serial_SendByte(spoof_initialized);
+        if (value_len > 0) {
+            cached_start_save(buf[0]);
+        }
+        Serial_QueueByte(BYTE_START);
+        Serial_QueueByte(BYTE_LEN_1_BYTE);
+        Serial_QueueByte(spoof_initialized);
         started = 1;
         break;
     case BYTE_CONTROL_DATA:
-        spoofReply = 1;
-        spoofReplyLen = value_len;
+        if (!controlDeferred) {
+            break; // late reply, the transfer was stalled or cancelled
+        }
+        if (!framing) {
+            control_reply(buf, value_len);
+        } else if (value_len > 0 && buf[0] == controlTag) {
+            control_reply(buf + 1, value_len - 1);
+        }
         break;
     case BYTE_RESET:
         forceHardReset();
         break;
     case BYTE_IN_REPORT:
-        sendReport = 1;
-        reportLen = value_len;
+        publish_report(value_len);
+        deltaBase = 1;
+        //no answer
+        break;
+    case BYTE_IN_REPORT_DELTA:
+        apply_report_delta();
         //no answer
         break;
     case BYTE_IDS:
@@ -140,63 +906,397 @@ static inline void handle_packet(void) {
         //no answer
         break;
     case BYTE_BAUDRATE:
-        if (value_len > 0) {
-          baudrate = buf[0];
-          PORTD |= (1 << 3); // keep TX high while reconfiguring
-          Serial_Disable();
-          Serial_Init(baudrate * 100000U, true);
-          PORTD &= ~(1 << 3); // release TX
-          UCSR1B |= (1 << RXCIE1); // Enable the USART Receive Complete interrupt (USART_RXC)
+        if (value_len > 0 && !baudrate_valid(buf[0])) {
+          Serial_QueueByte(BYTE_BAUDRATE);
+          Serial_QueueByte(1);
+          Serial_QueueByte(BYTE_BAUDRATE_INVALID);
+        } else if (value_len > 1 && buf[1]) {
+          Serial_QueueByte(BYTE_BAUDRATE);
+          Serial_QueueByte(1);
+          Serial_QueueByte(buf[0]);
+          baudrate_trial_start(buf[0]);
+        } else if (value_len > 0) {
+          serial_configure(buf[0]);
           //no answer
         } else {
-          Serial_SendByte(BYTE_BAUDRATE);
-          Serial_SendByte(1);
-          Serial_SendByte(baudrate);
+          Serial_QueueByte(BYTE_BAUDRATE);
+          Serial_QueueByte(1);
+          Serial_QueueByte(baudrate);
         }
         break;
     case BYTE_VERSION:
-        Serial_SendByte(BYTE_VERSION);
-        Serial_SendByte(2);
-        Serial_SendByte(version_major);
-        Serial_SendByte(version_minor);
+        Serial_QueueByte(BYTE_VERSION);
+        Serial_QueueByte(2);
+        Serial_QueueByte(version_major);
+        Serial_QueueByte(version_minor);
+        if (value_len > 0 && buf[0] >= PROTOCOL_VERSION_FRAMING && !framing) {
+            // the reply is the last packet without framing
+            framing = 1;
+            rx_state = RX_STATE_START;
+            framesBad = 0;
+            framingIdle = 0;
+            framingCheck = timer_read();
+        }
+        break;
+    case BYTE_FRAME_PHASE:
+        send_frame_phase();
+        break;
+    case BYTE_STATS:
+        send_stats();
+        break;
+    case BYTE_BAUDRATE_TEST:
+        baudrate_test();
+        break;
+    case BYTE_BATCH:
+        if (framing) {
+            handle_batch();
+        }
+        break;
+    case BYTE_REPORT_POLICY:
+        if (value_len >= 5) {
+            policyFlags = buf[0];
+            keepAliveFrames = buf[1] | buf[2] << 8;
+            silenceFrames = buf[3] | buf[4] << 8;
+        }
+        Serial_QueueByte(BYTE_REPORT_POLICY);
+        Serial_QueueByte(5);
+        Serial_QueueByte(policyFlags);
+        Serial_QueueByte(keepAliveFrames & 0xff);
+        Serial_QueueByte(keepAliveFrames >> 8);
+        Serial_QueueByte(silenceFrames & 0xff);
+        Serial_QueueByte(silenceFrames >> 8);
+        break;
+    case BYTE_NEUTRAL_REPORT:
+        if (value_len <= ADAPTER_IN_SIZE) {
+            memcpy(neutralReport, buf, value_len);
+            neutralLen = value_len;
+        }
+        //no answer
+        break;
+    case BYTE_IN_INTERVAL:
+        if (value_len > 0 && !started) {
+            inInterval = buf[0];
+        }
+        Serial_QueueByte(BYTE_IN_INTERVAL);
+        Serial_QueueByte(BYTE_LEN_1_BYTE);
+        Serial_QueueByte(in_interval());
         break;
     }
 }
+
 /*
+ * Handle the packets of a checked batch frame, from the receive ring.
+ */
+static void handle_batch(void) {
+
+    uint8_t pos = rx_batch;
+    uint8_t end = (rx_batch + value_len) % RX_BUFFER_SIZE;
+
+    while (pos != end) {
+        packet_type = rx_buffer[pos];
+        pos = (pos + 1) % RX_BUFFER_SIZE;
+        if (pos == end || packet_type == BYTE_BATCH) {
+            ++framesDropped;
+            return;
+        }
+        value_len = rx_buffer[pos];
+        pos = (pos + 1) % RX_BUFFER_SIZE;
+        pdata = packet_data();
+        if (pdata == NULL || (uint8_t) (end - pos) % RX_BUFFER_SIZE < value_len) {
+            ++framesDropped;
+            return;
+        }
+        for (i = 0; i < value_len; ++i) {
+            pdata[i] = rx_buffer[pos];
+            pos = (pos + 1) % RX_BUFFER_SIZE;
+        }
+        i = 0;
+        handle_packet();
+    }
+}
+
 ISR(USART1_RX_vect) {
 
-    packet_type = UDR1;
-    value_len = Serial_BlockingReceiveByte();
-    pdata = (packet_type == BYTE_IN_REPORT) ? report : buf;
-    while (i < value_len) {
-        pdata[i++] = Serial_BlockingReceiveByte();
+    uint8_t head = rx_head;
+    uint8_t next = (head + 1) % RX_BUFFER_SIZE;
+
+    if (UCSR1A & ((1 << FE1) | (1 << DOR1))) { // flags have to be read before the data register
+        ++rxErrors;
     }
+
+    uint8_t byte = UDR1;
+
+    if (next == rx_tail) {
+        if (!framing) {
+            forceHardReset(); // the main loop is not keeping up
+        }
+        return; // the frame will be dropped
+    }
+
+    rx_buffer[head] = byte;
+    rx_head = next;
+}
+
+/*
+ * Drop back to the protocol without framing at the default baudrate, so that a host that lost the framing state can
+ * reach the adapter again. The received bytes are dropped until the line is quiet, returns the position to parse from.
+ */
+static uint8_t framing_recover(void) {
+
+    bank_drop();
+
+    framing = 0;
+    tx_state = TX_STATE_TYPE;
     i = 0;
-    handle_packet();
-}*/
+    rx_state = RX_STATE_DRAIN;
+    rx_start = timer_read();
+    deltaBase = 0;
 
-ISR(USART1_RX_vect) {
+    if (baudrate != USART_BAUDRATE) {
+        serial_configure(USART_BAUDRATE);
+    }
 
-    packet_type = UDR1;
-    /*
-     * Reset packet reception timer: assume the maximum reception time for any packet is 10ms, and hard reset the
-     * adapter if this time is exceeded. This helps recovering from a transmission error that could deadlock the
-     * adapter in the ISR. This also helps auto-sensing baudrate as the USB to UART driver may accept a baudrate
-     * setting that it does not actually support. An incorrect baudrate will result in a transmission issue that will
-     * trigger a hard reset on firmware side, and a fallback to a lower baudrate on software side.
-     */
-    TCNT1 = 0;
-    if (!Serial_WaitByte(&value_len)) {
+    rx_tail = rx_head;
+    return rx_tail;
+}
+
+/*
+ * Count the time since the last good frame.
+ */
+static inline void framing_idle_update(void) {
+
+    uint16_t now = timer_read();
+    uint16_t elapsed = now - framingCheck;
+
+    framingCheck = now;
+    if (elapsed >= FRAMING_RECOVERY_TIMEOUT - framingIdle) {
+        framingIdle = FRAMING_RECOVERY_TIMEOUT;
+    } else {
+        framingIdle += elapsed;
+    }
+}
+
+/*
+ * Handle a bad packet: without framing the only way to recover is a hard reset, with framing the bad frame is dropped
+ * and parsing restarts right after its start byte, unless the framing has to be recovered.
+ * During a baudrate trial, the received bytes are dropped instead.
+ */
+static inline uint8_t rx_error(void) {
+
+    bank_drop();
+
+    i = 0;
+    rx_state = framing ? RX_STATE_START : RX_STATE_TYPE;
+
+    if (baudrateTrial != BAUDRATE_TRIAL_NONE) {
+        baudrateTrial = BAUDRATE_TRIAL_FAILED;
+        rx_tail = rx_head;
+        return rx_tail;
+    }
+
+    if (!framing) {
         forceHardReset();
     }
-    pdata = (packet_type == BYTE_IN_REPORT) ? report : buf;
-    while (i < value_len) {
-        if (!Serial_WaitByte(pdata + (i++))) {
-            forceHardReset();
-        }
+
+    ++framesDropped;
+    deltaBase = 0;
+
+    if (++framesBad >= FRAMING_RECOVERY_ERRORS || framingIdle >= FRAMING_RECOVERY_TIMEOUT) {
+        return framing_recover();
     }
+
+    return rx_tail;
+}
+
+/*
+ * Handle a complete packet (and check its frame when framing).
+ */
+static inline void rx_complete(uint8_t pos) {
+
     i = 0;
-    handle_packet();
+    if (framing) {
+        rx_state = RX_STATE_START;
+        if (rx_sequence != rx_expected) {
+            framesLost += (uint8_t) (rx_sequence - rx_expected);
+            deltaBase = 0;
+        }
+        rx_expected = rx_sequence + 1;
+        framesBad = 0;
+        framingIdle = 0;
+        handle_packet();
+        rx_tail = pos; // batches are handled from the ring
+    } else {
+        rx_state = RX_STATE_TYPE;
+        handle_packet();
+    }
+}
+
+/*
+ * Check the baudrate trial: a reception error fails it, and the received bytes are then dropped until the timeout,
+ * which restores the previous baudrate. Returns 1 if the received bytes have to be dropped.
+ */
+static inline uint8_t baudrate_trial_task(void) {
+
+    if (rxErrors) {
+        baudrateTrial = BAUDRATE_TRIAL_FAILED;
+    }
+
+    if ((uint16_t) (timer_read() - baudrateStart) >= BAUDRATE_TRIAL_TIMEOUT) {
+        bank_drop();
+        serial_configure(baudrateFallback);
+        baudrateTrial = BAUDRATE_TRIAL_NONE;
+        i = 0;
+        rx_state = framing ? RX_STATE_START : RX_STATE_TYPE;
+        rx_tail = rx_pos = rx_head;
+        return 1;
+    }
+
+    if (baudrateTrial == BAUDRATE_TRIAL_FAILED) {
+        rx_tail = rx_pos = rx_head;
+        return 1;
+    }
+
+    return 0;
+}
+
+/*
+ * Parse the received bytes, and handle complete packets.
+ * This has to be called from the main loop, and from any loop waiting for a packet.
+ */
+void Packet_Task(void) {
+
+    if (baudrateTrial != BAUDRATE_TRIAL_NONE && baudrate_trial_task()) {
+        return;
+    }
+
+    if (framing) {
+        framing_idle_update();
+    }
+
+    uint8_t pos = rx_pos;
+    uint8_t endpoint = Endpoint_GetCurrentEndpoint();
+
+    while (pos != rx_head) {
+
+        uint8_t byte = rx_buffer[pos];
+        pos = (pos + 1) % RX_BUFFER_SIZE;
+
+        if (!framing) {
+            rx_tail = pos;
+        } else if (rx_state != RX_STATE_START && rx_state < RX_STATE_CRC_LOW) {
+            rx_crc = _crc_ccitt_update(rx_crc, byte);
+        }
+
+        switch (rx_state) {
+        case RX_STATE_START:
+            rx_tail = pos; // parsing restarts here if this is a false start
+            if (byte == BYTE_FRAME_START) {
+                rx_start = timer_read();
+                rx_crc = FRAME_CRC_INIT;
+                rx_state = RX_STATE_SEQUENCE;
+            } else if (framingIdle >= FRAMING_RECOVERY_TIMEOUT && baudrateTrial == BAUDRATE_TRIAL_NONE) {
+                pos = framing_recover(); // a byte outside a frame, after the silence of a host that lost the framing
+            }
+            break;
+        case RX_STATE_SEQUENCE:
+            rx_sequence = byte;
+            rx_state = RX_STATE_TYPE;
+            break;
+        case RX_STATE_TYPE:
+            packet_type = byte;
+            /*
+             * Start packet reception timer: assume the maximum reception time for any packet is 10ms, and hard reset
+             * the adapter if this time is exceeded. This helps recovering from a transmission error that could
+             * deadlock the packet parser. This also helps auto-sensing baudrate as the USB to UART driver may accept
+             * a baudrate setting that it does not actually support. An incorrect baudrate will result in a
+             * transmission issue that will trigger a hard reset on firmware side, and a fallback to a lower baudrate
+             * on software side.
+             * With framing, the timer is started by the start byte, and a timeout only drops the frame.
+             */
+            if (!framing) {
+                rx_start = timer_read();
+            }
+            rx_state = RX_STATE_LENGTH;
+            break;
+        case RX_STATE_LENGTH:
+            value_len = byte;
+            i = 0;
+            if (packet_type == BYTE_BATCH && framing) {
+                if (value_len > BATCH_MAX_SIZE) {
+                    pos = rx_error();
+                    break;
+                }
+                rx_batch = pos;
+                rx_state = value_len > 0 ? RX_STATE_BATCH : RX_STATE_CRC_LOW;
+                break;
+            }
+            pdata = packet_data();
+            if (pdata == NULL) {
+                pos = rx_error();
+                break;
+            }
+            if (packet_type == BYTE_IN_REPORT) {
+                bank_fill();
+            }
+            if (value_len > 0) {
+                rx_state = RX_STATE_VALUE;
+            } else if (framing) {
+                rx_state = RX_STATE_CRC_LOW;
+            } else {
+                rx_complete(pos);
+            }
+            break;
+        case RX_STATE_VALUE:
+            pdata[i++] = byte;
+            if (bankState == BANK_FILLING) {
+                Endpoint_SelectEndpoint(ADAPTER_IN_NUM);
+                Endpoint_Write_8(byte);
+            }
+            if (i == value_len) {
+                if (framing) {
+                    rx_state = RX_STATE_CRC_LOW;
+                } else {
+                    rx_complete(pos);
+                }
+            }
+            break;
+        case RX_STATE_BATCH:
+            if (++i == value_len) {
+                rx_state = RX_STATE_CRC_LOW;
+            }
+            break;
+        case RX_STATE_CRC_LOW:
+            if (byte != (rx_crc & 0xff)) {
+                pos = rx_error();
+                break;
+            }
+            rx_state = RX_STATE_CRC_HIGH;
+            break;
+        case RX_STATE_CRC_HIGH:
+            if (byte != (rx_crc >> 8)) {
+                pos = rx_error();
+                break;
+            }
+            rx_complete(pos);
+            break;
+        case RX_STATE_DRAIN:
+            rx_start = timer_read();
+            break;
+        }
+    }
+
+    rx_pos = pos;
+
+    Endpoint_SelectEndpoint(endpoint);
+
+    if (rx_state != (framing ? RX_STATE_START : RX_STATE_TYPE)
+            && (uint16_t) (timer_read() - rx_start) >= PACKET_TIMEOUT) {
+        if (rx_state == RX_STATE_DRAIN) {
+            rx_state = RX_STATE_TYPE;
+        } else {
+            rx_pos = rx_error();
+        }
+    }
 }
 
 void SetupHardware(void) {
@@ -206,7 +1306,11 @@ void SetupHardware(void) {
 
     clock_prescale_set(clock_div_1);
 
-    TCCR1B |= (1 << CS12); // Set up timer at FCPU / 256
+#ifdef ADAPTER_PERSONAS
+    Persona_Load();
+#endif
+
+    TCCR1B |= (1 << CS11) | (1 << CS10); // Set up timer at FCPU / 64
 
     Serial_Init(baudrate * 100000U, true);
 
@@ -214,9 +1318,18 @@ void SetupHardware(void) {
 
     GlobalInterruptEnable();
 
-    while (!started) {}
+    cached_start_load();
+
+    while (!started) {
+        Packet_Task();
+    }
 
+#ifdef ADAPTER_NO_USB
+    frameStart = timer_read();
+    Adapter_Init();
+#else
     USB_Init();
+#endif
 }
 
 void EVENT_USB_Device_Connect(void) {
@@ -227,26 +1340,248 @@ void EVENT_USB_Device_Disconnect(void) {
 
 void EVENT_USB_Device_ConfigurationChanged(void) {
 
-    Endpoint_ConfigureEndpoint(ADAPTER_IN_NUM, EP_TYPE_INTERRUPT, ADAPTER_IN_SIZE, 1);
+    Endpoint_ConfigureEndpoint(ADAPTER_IN_NUM, EP_TYPE_INTERRUPT, ADAPTER_IN_SIZE, ADAPTER_IN_BANKS);
 #ifdef ADAPTER_OUT_NUM
-    Endpoint_ConfigureEndpoint(ADAPTER_OUT_NUM, EP_TYPE_INTERRUPT, ADAPTER_OUT_SIZE, 1);
+    Endpoint_ConfigureEndpoint(ADAPTER_OUT_NUM, EP_TYPE_INTERRUPT, ADAPTER_OUT_SIZE, ADAPTER_OUT_BANKS);
+#endif
+
+    Endpoint_SelectEndpoint(ADAPTER_IN_NUM);
+    UEINTX = (uint8_t) ~(1 << NAKINI);
+
+    pollValid = 0;
+    pollPeriod = 0;
+    inFlight = 0;
+    bankState = BANK_EMPTY;
+    reportKnown = 0;
+
+    USB_Device_EnableSOFEvents();
+}
+
+/*
+ * Interrupts must be disabled.
+ */
+static inline void report_read(uint16_t now) {
+
+    uint16_t bucket = (uint16_t) (now - inTime) >> LATENCY_BUCKET_SHIFT;
+
+    if (bucket >= LATENCY_BUCKETS) {
+        bucket = LATENCY_BUCKETS - 1;
+    }
+    if (latencies[bucket] != UINT16_MAX) {
+        ++latencies[bucket];
+    }
+    inFlight = 0;
+}
+
+/*
+ * Interrupts must be disabled.
+ */
+static inline void poll_seen(uint8_t frame) {
+
+    uint8_t elapsed = frame - lastPoll;
+
+    if (pollValid && elapsed > 0 && elapsed <= in_interval() && (pollPeriod == 0 || elapsed < pollPeriod)) {
+        pollPeriod = elapsed;
+    }
+    lastPoll = frame;
+    pollValid = 1;
+}
+
+void EVENT_USB_Device_StartOfFrame(void) {
+
+    uint8_t endpoint = Endpoint_GetCurrentEndpoint();
+    uint8_t frame = frameCount++;
+
+    frameStart = TCNT1;
+
+    Endpoint_SelectEndpoint(ADAPTER_IN_NUM);
+
+    /*
+     * Writing 1 to the other flags has no effect: a read-modify-write would clear TXINI if the bank was read meanwhile.
+     */
+    if (UEINTX & (1 << NAKINI)) {
+        UEINTX = (uint8_t) ~(1 << NAKINI);
+        poll_seen(frame);
+    }
+#if ADAPTER_IN_BANKS > 1
+    /*
+     * TXINI is set as long as a bank is free, the read is only seen here: it was in the previous frame, which is
+     * counted as read in its middle.
+     */
+    else if (inFlight && in_bank_idle()) {
+        uint16_t read = frameStart - FRAME_TICKS / 2;
+        report_read((int16_t) (read - inTime) < 0 ? inTime : read);
+        poll_seen(frame);
+    }
+#endif
+
+    Endpoint_SelectEndpoint(endpoint);
+}
+
+#if !defined(ADAPTER_NO_USB) && ADAPTER_IN_BANKS == 1
+/*
+ * The host read the report in the IN endpoint bank: TXINI is set again. The interrupt is only enabled while a report
+ * is in flight, so that this is the time of the poll.
+ */
+ISR(USB_COM_vect) {
+
+    uint8_t endpoint = Endpoint_GetCurrentEndpoint();
+
+    Endpoint_SelectEndpoint(ADAPTER_IN_NUM);
+    UEIENX &= ~(1 << TXINE);
+
+    if (inFlight) {
+        report_read(TCNT1);
+        poll_seen(frameCount);
+    }
+
+    Endpoint_SelectEndpoint(endpoint);
+}
 #endif
+
+/*
+ * Write a report to the selected IN endpoint, which has to be ready. Reports fit in the bank, so that unlike
+ * Endpoint_Write_Stream_LE there is no check per byte, and full reports are written with a loop unrolled 8 times.
+ */
+static inline void report_write(const uint8_t * data, uint8_t len) {
+
+    if (ADAPTER_IN_SIZE >= 8 && len == ADAPTER_IN_SIZE) {
+        uint8_t blocks = ADAPTER_IN_SIZE / 8;
+        do {
+            Endpoint_Write_8(*data++);
+            Endpoint_Write_8(*data++);
+            Endpoint_Write_8(*data++);
+            Endpoint_Write_8(*data++);
+            Endpoint_Write_8(*data++);
+            Endpoint_Write_8(*data++);
+            Endpoint_Write_8(*data++);
+            Endpoint_Write_8(*data++);
+        } while (--blocks);
+        len = ADAPTER_IN_SIZE % 8;
+    }
+    while (len--) {
+        Endpoint_Write_8(*data++);
+    }
+}
+
+#ifdef ADAPTER_NO_USB
+/*
+ * The firmware builds the console data right away, so there is no bank to hold: each complete report replaces the
+ * previous one, which counts as dropped if the console did not read it.
+ */
+void SendNextReport(void) {
+
+    if (!sendReport) {
+        return;
+    }
+
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+        if (inFlight) {
+            ++reportsDropped;
+        }
+        inTime = reportTimes[reportReady];
+        inFlight = 1;
+    }
+
+    Adapter_SendReport(reports[reportReady], reportLens[reportReady]);
+    sendReport = 0;
+    reportKnown = 1;
+    idleFrames = 0;
+}
+
+/*
+ * Count the frames, one per millisecond. This has to be called from the main loop.
+ */
+static inline void frame_task(void) {
+
+    uint16_t now = timer_read();
+
+    while ((uint16_t) (now - frameStart) >= FRAME_TICKS) {
+        frameStart += FRAME_TICKS;
+        ++frameCount;
+    }
 }
 
+/*
+ * A console poll started at the given Timer1 time: it read the last report, unless this one is newer.
+ * Consoles poll in bursts while they configure the controller, so that the period is the last interval between two
+ * polls, instead of the shortest one. This has to be called from the main loop.
+ */
+void Adapter_PollSeen(uint16_t time) {
+
+    uint8_t frame;
+    uint8_t elapsed;
+    int16_t ago;
+
+    frame_task();
+
+    frame = frameCount;
+    ago = frameStart - time;
+    if (ago > 0) {
+        frame -= (ago - 1) / FRAME_TICKS + 1;
+    }
+    elapsed = frame - lastPoll;
+
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+        if (inFlight && (int16_t) (time - inTime) >= 0) {
+            report_read(time);
+        }
+        if (pollValid && elapsed > 0 && elapsed <= in_interval()) {
+            pollPeriod = elapsed;
+        }
+        lastPoll = frame;
+        pollValid = 1;
+    }
+}
+#else
 void SendNextReport(void) {
 
+    uint8_t latch = 1;
+
     Endpoint_SelectEndpoint(ADAPTER_IN_NUM);
 
-    if (sendReport) {
+    if ((!sendReport && !inFlight) || !in_bank_idle()) {
+        return;
+    }
+
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+        if (inFlight) {
+            // read in this frame
+            report_read(TCNT1);
+            poll_seen(frameCount);
+        }
+        /*
+         * Hold the report until the frame preceding the next poll, so that a newer report can still replace it.
+         * A missed poll keeps the window open.
+         */
+        if (pollPeriod && (uint8_t) (frameCount - lastPoll) < pollPeriod - 1) {
+            latch = 0;
+        }
+    }
+
+    if (bankState == BANK_STALE) {
+        bank_reset();
+    }
 
-        if (Endpoint_IsINReady()) {
+    if (sendReport && latch) {
 
-            Endpoint_Write_Stream_LE(report, reportLen, NULL);
-            sendReport = 0;
-            Endpoint_ClearIN();
+        if (bankState != BANK_STAGED) {
+            bank_drop(); // the complete report goes first
+            report_write(reports[reportReady], reportLens[reportReady]);
         }
+        bankState = BANK_EMPTY;
+        sendReport = 0;
+        reportKnown = 1;
+        idleFrames = 0;
+        inTime = reportTimes[reportReady];
+        Endpoint_ClearIN();
+        inFlight = 1;
+#if ADAPTER_IN_BANKS == 1
+        UEIENX |= (1 << TXINE);
+#endif
     }
 }
+#endif
 
 #ifdef ADAPTER_OUT_NUM
 void ReceiveNextReport(void) {
@@ -256,12 +1591,15 @@ void ReceiveNextReport(void) {
             uint8_t type;
             uint8_t length;
         } header;
-        uint8_t buffer[ADAPTER_OUT_SIZE];
+        uint8_t buffer[ADAPTER_OUT_MAX_SIZE];
     } packet = { .header.type = BYTE_OUT_REPORT };
 
     Endpoint_SelectEndpoint(ADAPTER_OUT_NUM);
 
-    if (Endpoint_IsOUTReceived()) {
+    /*
+     * Leave the packet in the endpoint until it can be queued: the host is NAKed meanwhile.
+     */
+    if (Endpoint_IsOUTReceived() && Serial_QueueFree() >= sizeof(packet) + FRAME_OVERHEAD) {
 
         uint16_t length = 0;
 
@@ -269,24 +1607,98 @@ void ReceiveNextReport(void) {
 
         if (Endpoint_IsReadWriteAllowed()) {
 
-            uint8_t ErrorCode = Endpoint_Read_Stream_LE(packet.buffer, sizeof(packet.buffer), &length);
+            uint8_t ErrorCode = Endpoint_Read_Stream_LE(packet.buffer, ADAPTER_OUT_SIZE, &length);
 
-            packet.header.length = (ErrorCode == ENDPOINT_RWSTREAM_NoError) ? sizeof(packet.buffer) : length;
+            packet.header.length = (ErrorCode == ENDPOINT_RWSTREAM_NoError) ? ADAPTER_OUT_SIZE : length;
         }
 
         Endpoint_ClearOUT();
 
         if (packet.header.length) {
-            Serial_SendData(&packet, sizeof(packet.header) + packet.header.length);
+            Serial_QueueData(&packet, sizeof(packet.header) + packet.header.length);
         }
     }
 }
 #endif
 
+/*
+ * Time out a deferred control transfer. This has to be called from the main loop.
+ */
+void Control_Task(void) {
+
+    if (!controlDeferred) {
+        return;
+    }
+
+    Endpoint_SelectEndpoint(ENDPOINT_CONTROLEP);
+
+    if (Endpoint_IsSETUPReceived()) {
+        controlDeferred = 0; // the host gave up, and sent a new request
+        controlSpoofs = 0;
+        return;
+    }
+
+    uint8_t frame = frameCount;
+    controlFrames += (uint8_t) (frame - controlFrame);
+    controlFrame = frame;
+
+    if (controlFrames >= SPOOF_TIMEOUT) {
+        controlDeferred = 0;
+        controlSpoofs = 0;
+        Endpoint_StallTransaction();
+    }
+}
+
+static inline uint16_t frames_add(uint16_t frames, uint8_t elapsed) {
+    return frames > UINT16_MAX - elapsed ? UINT16_MAX : frames + elapsed;
+}
+
+/*
+ * Apply the IN report policy: send the neutral report once the host is silent, and repeat the last report for the
+ * keep-alive when duplicates are suppressed.
+ */
+static inline void report_policy(void) {
+
+    uint8_t frame = frameCount;
+    uint8_t elapsed = frame - policyFrame;
+    uint8_t head = rx_head;
+
+    policyFrame = frame;
+    idleFrames = frames_add(idleFrames, elapsed);
+
+    if (head != policyHead) {
+        policyHead = head;
+        quietFrames = 0;
+        neutralSent = 0;
+    } else {
+        quietFrames = frames_add(quietFrames, elapsed);
+    }
+
+    if (silenceFrames && quietFrames >= silenceFrames && neutralLen && !neutralSent
+            && rx_state == (framing ? RX_STATE_START : RX_STATE_TYPE)) {
+        memcpy(reports[reportFill], neutralReport, neutralLen);
+        publish_report(neutralLen);
+        deltaBase = 0;
+        neutralSent = 1;
+    }
+
+    if ((policyFlags & REPORT_POLICY_SUPPRESS_DUPLICATES) && keepAliveFrames && idleFrames >= keepAliveFrames
+            && reportKnown && !sendReport) {
+        reportTimes[reportReady] = timer_read();
+        sendReport = 1;
+    }
+}
+
 void HID_Task(void) {
 
+#ifdef ADAPTER_NO_USB
+    frame_task();
+#else
     if (USB_DeviceState != DEVICE_STATE_Configured)
         return;
+#endif
+
+    report_policy();
 
     SendNextReport();
 
@@ -300,7 +1712,16 @@ int main(void) {
     SetupHardware();
 
     while (1) {
+        Packet_Task();
+#ifdef ADAPTER_NO_USB
+        HID_Task();
+        Adapter_Task();
+#else
+        Control_Task();
         HID_Task();
         USB_USBTask();
+#endif
     }
 }
+
+#endif
@@ -16,7 +16,15 @@
 #define BYTE_VERSION      0x77
 #define BYTE_BAUDRATE     0x88
 #define BYTE_DEBUG        0x99
+#define BYTE_FRAME_PHASE  0xaa
+#define BYTE_STATS        0xbb
+#define BYTE_BAUDRATE_TEST 0xcc
+#define BYTE_BATCH        0xdd
 #define BYTE_OUT_REPORT   0xee
+#define BYTE_NEUTRAL_REPORT 0xfb
+#define BYTE_REPORT_POLICY 0xfc
+#define BYTE_IN_INTERVAL  0xfd
+#define BYTE_IN_REPORT_DELTA 0xfe
 #define BYTE_IN_REPORT    0xff
 
 #define BYTE_TYPE_JOYSTICK   0x00
@@ -40,4 +48,148 @@
 #define BYTE_LEN_0_BYTE 0x00
 #define BYTE_LEN_1_BYTE 0x01
 
+/*
+ * Protocol version 9 framing.
+ *
+ * The host requests it by sending BYTE_VERSION with a value holding the protocol version (9, 0).
+ * Adapters that support it reply with their version (>= 9.0), and wrap every packet after this reply, in both
+ * directions, into a frame:
+ *
+ * BYTE_FRAME_START | sequence | type | length | value | CRC (2 bytes, little-endian)
+ *
+ * The sequence number is incremented at each frame, the receiver counts the gaps.
+ * The CRC is avr-libc's _crc_ccitt_update() (reflected polynomial 0x8408) starting from FRAME_CRC_INIT,
+ * over the sequence, type, length and value bytes.
+ * Bad frames are dropped, and the receiver resynchronizes on the next BYTE_FRAME_START.
+ */
+#define BYTE_FRAME_START 0xa5
+
+#define PROTOCOL_VERSION_FRAMING 0x09
+
+#define FRAME_CRC_INIT 0xffff
+
+#define FRAME_OVERHEAD 4
+
+/*
+ * Framing recovery (adapter version >= 9.10): the adapter drops back to the protocol without framing, at the default
+ * baudrate (500Kbps), after FRAMING_RECOVERY_ERRORS consecutive bad frames, or at the first bad frame or byte outside a
+ * frame received FRAMING_RECOVERY_MS after the last good frame. It then drops the received bytes until the line is quiet
+ * for 10ms. A host that lost the framing state, e.g. after a restart or after switching to a baudrate that does not
+ * work:
+ *
+ * - sends nothing for FRAMING_RECOVERY_MS,
+ * - sends a single BYTE_NO_PACKET at 500Kbps, and waits 20ms,
+ * - talks to the adapter without framing as after power-up, e.g. BYTE_RESET, or BYTE_VERSION to request the framing.
+ *
+ * Hosts that keep the framing state can stay silent for any time, the next good frame is handled as usual.
+ */
+#define FRAMING_RECOVERY_ERRORS 8
+
+#define FRAMING_RECOVERY_MS 100
+
+/*
+ * BYTE_IN_REPORT_DELTA (adapter version >= 9.1): the value is a list of runs (offset, count, count bytes) to apply
+ * to the last IN report, keeping its length. With framing, deltas are ignored after a dropped or lost frame, until
+ * the next BYTE_IN_REPORT: hosts should send a full report from time to time.
+ */
+
+/*
+ * BYTE_FRAME_PHASE (adapter version >= 9.2): the host sends it without value, the adapter replies with the IN polling
+ * phase, measured with the USB start of frame events:
+ *
+ * polling period in frames (0 until measured) | frames since the last poll | time since the last start of frame in
+ * microseconds (2 bytes, little-endian)
+ *
+ * The adapter commits a report to the IN endpoint from the frame preceding a poll, until then newer reports replace it.
+ * Hosts can use the phase to complete their reports right before that frame.
+ */
+
+/*
+ * BYTE_STATS (adapter version >= 9.3): the host sends it with an optional 1-byte value, the adapter replies with its
+ * statistics, and clears them if the value is not 0. All fields are 2 bytes, little-endian:
+ *
+ * bucket width in microseconds | latency buckets | reports dropped | frames dropped | frames lost
+ *
+ * Latency buckets count the reports by the time from their last byte being parsed to the host reading them over
+ * USB, the last bucket counts the longer times. The number of buckets is (length - 8) / 2.
+ * The read time is the one of the poll for single-banked IN endpoints. Double-banked ones only see the read at the next
+ * start of frame, and count it in the middle of the frame of the poll: such times are within 0.5ms.
+ */
+
+/*
+ * Baudrate trial (adapter version >= 9.4): the host sends BYTE_BAUDRATE with a 2-byte value (baudrate in 100Kbps
+ * units, 1). The adapter acknowledges with BYTE_BAUDRATE and the new baudrate, then switches to it. At 16MHz, 10
+ * (1Mbps) and 20 (2Mbps) are exact. At the new baudrate, starting 1ms after the acknowledgement:
+ *
+ * - the host sends BYTE_BAUDRATE_TEST with the test pattern repeated over up to 64 bytes, the adapter echoes it,
+ * - the host sends BYTE_BAUDRATE_TEST without value to confirm the baudrate, the adapter replies the same.
+ *
+ * The adapter goes back to the previous baudrate BAUDRATE_TRIAL_TIMEOUT_MS after the acknowledgement if it did not
+ * get the confirmation. After a bad byte, packet or pattern, it ignores the received bytes until then. The host
+ * steps the baudrate up one trial at a time, and falls back after a missing or bad reply by waiting for the timeout.
+ */
+#define BAUDRATE_TEST_PATTERN { 0x55, 0xaa, 0x00, 0xff, 0x0f, 0xf0, 0x33, 0xcc }
+#define BAUDRATE_TEST_PATTERN_SIZE 8
+
+#define BAUDRATE_TRIAL_TIMEOUT_MS 100
+
+/*
+ * Baudrate range (adapter version >= 9.12): the value is valid from 1 to F_CPU / 800000, 20 (2Mbps) at 16MHz. The
+ * adapter replies to BYTE_BAUDRATE with an invalid value, with or without trial, with BYTE_BAUDRATE and
+ * BYTE_BAUDRATE_INVALID, and keeps its baudrate.
+ */
+#define BYTE_BAUDRATE_INVALID 0x00
+
+/*
+ * BYTE_BATCH (adapter version >= 9.5, with framing only): the value is a list of packets (type, length, value),
+ * handled in order once the frame is checked, e.g. an IN report and a control reply sent in a single write. Batches
+ * can't be nested, and their value can't be longer than BATCH_MAX_SIZE. Packets from a malformed batch are handled
+ * up to the malformed one, which counts as a dropped frame.
+ */
+#define BATCH_MAX_SIZE 192
+
+/*
+ * Persona (adapter version >= 9.6, multi-persona firmwares): the host sends BYTE_TYPE with a 1-byte value holding
+ * the adapter type to emulate. The adapter saves it for the next boots and, if it is started, re-enumerates with the
+ * descriptors of this type. The reply holds the adapter type, which is unchanged if the requested one is not supported.
+ * Each persona enumerates as the firmware of its type, control endpoint size included. Other adapters ignore the
+ * value. The host waits for the reply before sending other packets.
+ */
+
+/*
+ * BYTE_IN_INTERVAL (adapter version >= 9.7): the host sends it with an optional 1-byte value holding the polling
+ * interval of the IN endpoint in milliseconds, 0 for the one of the emulated controller. The adapter replies with the
+ * interval it declares. The value is ignored once the adapter is started, as the host has to request the interval
+ * before the enumeration. Consoles may not support other intervals than the ones of the emulated controllers.
+ */
+
+/*
+ * Cached start (adapter version >= 9.8): the host sends BYTE_START with a 1-byte value. If it is not 0, the adapter
+ * saves its state (spoof status, IN interval, ids) and, at the next boots, enumerates with it right after power-up
+ * instead of waiting for BYTE_START. The host then syncs with the started adapter as usual. Sending it again updates
+ * the saved state, e.g. once spoofed, and a 0 value disables the cached start.
+ */
+
+/*
+ * IN report policy (adapter version >= 9.9): the host sends BYTE_REPORT_POLICY with an optional 5-byte value, the
+ * adapter replies with its policy. All fields but the flags are 2 bytes, little-endian:
+ *
+ * flags | keep-alive period in milliseconds | silence timeout in milliseconds
+ *
+ * With REPORT_POLICY_SUPPRESS_DUPLICATES, a report identical to the last one read by the console is not sent again,
+ * except once per keep-alive period if it is not 0, for consoles that need a steady report rate.
+ * If the silence timeout is not 0, the adapter sends the neutral report once the host sent nothing for this time,
+ * e.g. after a crash, so that inputs don't stay stuck. The neutral report is the value of BYTE_NEUTRAL_REPORT (no
+ * answer), it depends on the emulated controller: it is cleared by a persona change, and an empty value clears it.
+ * Deltas are ignored after a neutral report, until the next full report.
+ */
+#define REPORT_POLICY_SUPPRESS_DUPLICATES 0x01
+
+/*
+ * Control reply tag (adapter version >= 9.11, with framing only): the value of a forwarded control request starts with
+ * a 1-byte tag, incremented at each request, followed by the setup packet and the data. The host starts the value of
+ * the reply with the same tag. The adapter drops replies that don't match the request being deferred, e.g. a reply
+ * received after the request was stalled, or after the console sent a new request.
+ */
+
 #endif